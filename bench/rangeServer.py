@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Static file server with single-range Range, If-Range, ETag and
+Last-Modified support, for benchmarking the downloader offline.
+
+Usage: rangeServer.py DIRECTORY [--host ADDR] [--port PORT]
+"""
+import argparse
+import email.utils
+import http.server
+import os
+import re
+
+
+class RangeHandler(http.server.SimpleHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def send_head(self):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return None
+
+        f = open(path, "rb")
+        st = os.fstat(f.fileno())
+        size = st.st_size
+        etag = '"%x-%x"' % (st.st_mtime_ns, size)
+        last_modified = email.utils.formatdate(st.st_mtime, usegmt=True)
+
+        start, end = 0, size - 1
+        partial = False
+        spec = self.headers.get("Range")
+        if_range = self.headers.get("If-Range")
+        if spec and (if_range is None or if_range in (etag, last_modified)):
+            m = re.fullmatch(r"bytes=(\d*)-(\d*)", spec.strip())
+            if m and (m.group(1) or m.group(2)):
+                if m.group(1):
+                    start = int(m.group(1))
+                    end = min(int(m.group(2)), size - 1) if m.group(2) else size - 1
+                else:
+                    start = max(0, size - int(m.group(2)))
+                if start >= size or start > end:
+                    f.close()
+                    self.send_response(416)
+                    self.send_header("Content-Range", "bytes */%d" % size)
+                    self.send_header("Content-Length", "0")
+                    self.end_headers()
+                    return None
+                partial = True
+
+        self.send_response(206 if partial else 200)
+        if partial:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, size))
+        self.send_header("Content-Length", str(end - start + 1))
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("ETag", etag)
+        self.send_header("Last-Modified", last_modified)
+        self.end_headers()
+
+        f.seek(start)
+        self.remaining = end - start + 1
+        return f
+
+    def copyfile(self, source, outputfile):
+        while self.remaining > 0:
+            block = source.read(min(256 * 1024, self.remaining))
+            if not block:
+                break
+            outputfile.write(block)
+            self.remaining -= len(block)
+
+    def log_message(self, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("directory")
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    args = parser.parse_args()
+
+    os.chdir(args.directory)
+    server = http.server.ThreadingHTTPServer((args.host, args.port), RangeHandler)
+    server.daemon_threads = True
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
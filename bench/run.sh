@@ -0,0 +1,180 @@
+#!/bin/bash
+# Offline throughput benchmark for the downloader.
+#
+# Builds two network namespaces joined by one veth pair per emulated link,
+# shapes each link with tbf (bandwidth) and, when the kernel has it, netem
+# (delay and loss), serves random files from a local Range-capable HTTP
+# server and times `download` over every interface mix and file size.
+# Needs root, iproute2, tc and python3; run it from anywhere after building
+# `download` (and `network` for --measure) as described in the README.
+
+set -euo pipefail
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+DOWNLOAD=${DOWNLOAD:-$BENCH_DIR/../download}
+NETWORK=${NETWORK:-$BENCH_DIR/../network}
+
+# name=rate,delay,loss% per link; the client side of each link is the
+# interface bench-NAME (long enough for `network`, which skips short names)
+LINKS="fast=100mbit,5ms,0 medium=40mbit,20ms,0 slow=10mbit,60ms,1"
+MIXES="fast medium,slow fast,medium,slow"
+SIZES="16M 128M"
+REPEAT=1
+MEASURE=0
+PORT=8080
+
+SRV_NS=mushb-srv
+CLI_NS=mushb-cli
+SERVICE_IP=10.78.0.1
+
+usage() {
+    cat <<EOF
+Usage: $0 [--links "NAME=RATE,DELAY,LOSS ..."] [--mixes "A,B C ..."]
+          [--sizes "16M 128M"] [--repeat N] [--measure] [--port PORT]
+
+  --links    emulated links (default: "$LINKS")
+  --mixes    space separated interface sets to benchmark (default: "$MIXES")
+  --sizes    file sizes, as accepted by head -c (default: "$SIZES")
+  --repeat   runs per size and mix (default: $REPEAT)
+  --measure  score the links with \`network --probe-url\` first, so chunks are
+             allocated by score instead of equally
+EOF
+}
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --links) LINKS=$2; shift 2 ;;
+        --mixes) MIXES=$2; shift 2 ;;
+        --sizes) SIZES=$2; shift 2 ;;
+        --repeat) REPEAT=$2; shift 2 ;;
+        --measure) MEASURE=1; shift ;;
+        --port) PORT=$2; shift 2 ;;
+        -h|--help) usage; exit 0 ;;
+        *) usage >&2; exit 1 ;;
+    esac
+done
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "The benchmark creates network namespaces and must run as root" >&2
+    exit 1
+fi
+if [ ! -x "$DOWNLOAD" ]; then
+    echo "Build the download CLI first (or set DOWNLOAD=path): $DOWNLOAD not found" >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d /tmp/mush-bench.XXXXXX)
+SERVER_PID=
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then kill "$SERVER_PID" 2>/dev/null || true; fi
+    # Deleting the namespaces also removes every veth pair and qdisc
+    ip netns del "$SRV_NS" 2>/dev/null || true
+    ip netns del "$CLI_NS" 2>/dev/null || true
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+# tbf needs a bucket of at least one timer tick of traffic
+burst_for() {
+    local rate=$1 bits
+    case "$rate" in
+        *gbit) bits=$(( ${rate%gbit} * 1000000000 )) ;;
+        *mbit) bits=$(( ${rate%mbit} * 1000000 )) ;;
+        *kbit) bits=$(( ${rate%kbit} * 1000 )) ;;
+        *) echo "Unsupported rate $rate (use kbit, mbit or gbit)" >&2; exit 1 ;;
+    esac
+    local bytes=$(( bits / 8 / 250 ))
+    [ "$bytes" -lt 32768 ] && bytes=32768
+    echo "$bytes"
+}
+
+ip netns del "$SRV_NS" 2>/dev/null || true
+ip netns del "$CLI_NS" 2>/dev/null || true
+ip netns add "$SRV_NS"
+ip netns add "$CLI_NS"
+ip -n "$SRV_NS" link set lo up
+ip -n "$CLI_NS" link set lo up
+ip -n "$SRV_NS" addr add "$SERVICE_IP/32" dev lo
+
+HAVE_NETEM=0
+if ip netns exec "$SRV_NS" tc qdisc add dev lo root netem delay 1ms 2>/dev/null; then
+    ip netns exec "$SRV_NS" tc qdisc del dev lo root
+    HAVE_NETEM=1
+else
+    echo "Note: netem is not available; links are bandwidth-limited only (no delay or loss)" >&2
+fi
+
+i=0
+for spec in $LINKS; do
+    name=${spec%%=*}
+    IFS=, read -r rate delay loss <<< "${spec#*=}"
+    if ! [[ "$name" =~ ^[a-z][a-z0-9]{0,8}$ ]]; then
+        echo "Link name '$name' must be 1-9 lowercase letters or digits" >&2
+        exit 1
+    fi
+    iface="bench-$name"
+    half_delay="$(( ${delay%ms} / 2 ))ms"
+
+    ip link add "$iface" netns "$CLI_NS" type veth peer name "s$i" netns "$SRV_NS"
+    ip -n "$CLI_NS" addr add "10.77.$i.1/24" dev "$iface"
+    ip -n "$SRV_NS" addr add "10.77.$i.2/24" dev "s$i"
+    ip -n "$CLI_NS" link set "$iface" up
+    ip -n "$SRV_NS" link set "s$i" up
+    # One default route per link; the downloader binds to each interface
+    ip -n "$CLI_NS" route add default via "10.77.$i.2" dev "$iface" metric $(( 100 + i ))
+
+    # Downstream (server to client) carries the bulk data, so shape there
+    burst=$(burst_for "$rate")
+    if [ "$HAVE_NETEM" -eq 1 ]; then
+        ip netns exec "$SRV_NS" tc qdisc add dev "s$i" root handle 1: netem delay "$half_delay" loss "$loss%"
+        ip netns exec "$SRV_NS" tc qdisc add dev "s$i" parent 1:1 handle 10: tbf rate "$rate" burst "$burst" latency 100ms
+        ip netns exec "$CLI_NS" tc qdisc add dev "$iface" root netem delay "$half_delay"
+    else
+        ip netns exec "$SRV_NS" tc qdisc add dev "s$i" root tbf rate "$rate" burst "$burst" latency 100ms
+    fi
+    i=$(( i + 1 ))
+done
+
+mkdir -p "$WORK/www" "$WORK/client"
+for size in $SIZES; do
+    head -c "$size" /dev/urandom > "$WORK/www/$size.bin"
+done
+
+ip netns exec "$SRV_NS" python3 "$BENCH_DIR/rangeServer.py" "$WORK/www" --port "$PORT" &
+SERVER_PID=$!
+for _ in $(seq 50); do
+    if ip netns exec "$SRV_NS" python3 -c "import socket; socket.create_connection(('$SERVICE_IP', $PORT), 1)" 2>/dev/null; then
+        break
+    fi
+    sleep 0.1
+done
+
+if [ "$MEASURE" -eq 1 ]; then
+    first_size=${SIZES%% *}
+    (cd "$WORK/client" && ip netns exec "$CLI_NS" "$NETWORK" \
+        --probe-url "http://$SERVICE_IP:$PORT/$first_size.bin" \
+        --tcp-target "$SERVICE_IP:$PORT" > /dev/null)
+fi
+
+python3 "$BENCH_DIR/summarize.py" header
+for size in $SIZES; do
+    for mix in $MIXES; do
+        for _ in $(seq "$REPEAT"); do
+            output="$WORK/client/out.bin"
+            rm -f "$output" "$output.mush"
+            status=ok
+            start=$(date +%s.%N)
+            # The client reads networks.json from its working directory
+            (cd "$WORK/client" && ip netns exec "$CLI_NS" "$DOWNLOAD" -i "bench-${mix//,/,bench-}" -o "$output" \
+                --monitor-socket "" --progress-interval 3600 \
+                "http://$SERVICE_IP:$PORT/$size.bin" > "$WORK/events.jsonl") || status=failed
+            end=$(date +%s.%N)
+            if [ "$status" = ok ] && ! cmp -s "$output" "$WORK/www/$size.bin"; then
+                status=corrupt
+            fi
+            python3 "$BENCH_DIR/summarize.py" row --links "$LINKS" --mix "$mix" --size "$size" \
+                --wall "$(awk "BEGIN { print $end - $start }")" --status "$status" --events "$WORK/events.jsonl"
+        done
+    done
+done
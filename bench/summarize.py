@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""Formats one benchmark run as a table row.
+
+Reads the JSON lines printed by `download` and reports wall time, aggregate
+goodput and, per link, the bytes it carried and how much of its configured
+rate it used over the run.
+"""
+import argparse
+import json
+import re
+import sys
+
+UNITS = {"kbit": 1e3, "mbit": 1e6, "gbit": 1e9}
+ROW = "{:>6}  {:<22} {:>8} {:>9}  {}"
+
+
+def parse_links(spec):
+    links = {}
+    for item in spec.split():
+        name, params = item.split("=", 1)
+        rate = params.split(",")[0]
+        m = re.fullmatch(r"(\d+)(kbit|mbit|gbit)", rate)
+        links[name] = int(m.group(1)) * UNITS[m.group(2)]
+    return links
+
+
+def main():
+    if sys.argv[1:] == ["header"]:
+        print(ROW.format("size", "mix", "wall s", "MB/s", "per link: MB carried, utilisation of its rate"))
+        return
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument("mode", choices=["row"])
+    parser.add_argument("--links", required=True)
+    parser.add_argument("--mix", required=True)
+    parser.add_argument("--size", required=True)
+    parser.add_argument("--wall", type=float, required=True)
+    parser.add_argument("--status", default="ok")
+    parser.add_argument("--events", required=True)
+    args = parser.parse_args()
+
+    finished = {}
+    with open(args.events) as f:
+        for line in f:
+            event = json.loads(line)
+            if event.get("event") == "finished":
+                finished = event
+
+    rates = parse_links(args.links)
+    downloaded = finished.get("downloaded", 0)
+    goodput = downloaded / args.wall / 1e6 if args.wall > 0 else 0
+
+    per_link = []
+    for lane in finished.get("interfaces", []):
+        name = lane["interface"]
+        if name.startswith("bench-"):
+            name = name[len("bench-"):]
+        carried = lane["bytes"]
+        utilisation = carried * 8 / args.wall / rates[name] * 100 if name in rates and args.wall > 0 else 0
+        per_link.append("{} {:.1f} MB {:.0f}%".format(name, carried / 1e6, utilisation))
+
+    details = ", ".join(per_link)
+    if args.status != "ok":
+        details = args.status.upper() + (" " + details if details else "")
+    print(ROW.format(args.size, args.mix, "{:.2f}".format(args.wall), "{:.2f}".format(goodput), details))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,91 @@
+#include "chunkJournal.h"
+
+#include <fstream>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <json/json.h>
+
+namespace {
+
+bool write_all(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Makes a rename in the directory holding path durable
+void sync_directory(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    fsync(fd);
+    ::close(fd);
+}
+
+} // namespace
+
+ChunkJournal::ChunkJournal(const std::string& output) : journal_path(output + ".mush") {}
+
+bool ChunkJournal::load(JournalState& state) const {
+    std::ifstream ifs(journal_path);
+    if (!ifs.is_open()) return false;
+
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(ifs, root) || !root.isObject()) return false;
+
+    state.url = root["url"].asString();
+    state.size = root["size"].asInt64();
+    state.etag = root["etag"].asString();
+    state.last_modified = root["last_modified"].asString();
+    state.chunk_size = root["chunk_size"].asInt64();
+    state.completed.clear();
+    for (const auto& range : root["completed"]) {
+        if (!range.isArray() || range.size() != 2) continue;
+        state.completed.push_back({range[0].asInt64(), range[1].asInt64()});
+    }
+    return state.size > 0;
+}
+
+bool ChunkJournal::save(const JournalState& state) const {
+    Json::Value root;
+    root["url"] = state.url;
+    root["size"] = Json::Int64(state.size);
+    root["etag"] = state.etag;
+    root["last_modified"] = state.last_modified;
+    root["chunk_size"] = Json::Int64(state.chunk_size);
+    root["completed"] = Json::arrayValue;
+    for (const auto& range : state.completed) {
+        Json::Value pair(Json::arrayValue);
+        pair.append(Json::Int64(range.start));
+        pair.append(Json::Int64(range.end));
+        root["completed"].append(pair);
+    }
+
+    // The data reaches the disk before the rename, so a crash leaves either
+    // the old journal or the complete new one, never an empty file
+    std::string tmp_path = journal_path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    Json::FastWriter writer;
+    bool written = write_all(fd, writer.write(root)) && fsync(fd) == 0;
+    if (::close(fd) != 0) written = false;
+    if (!written || std::rename(tmp_path.c_str(), journal_path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    sync_directory(journal_path);
+    return true;
+}
+
+void ChunkJournal::remove() const {
+    std::remove(journal_path.c_str());
+}
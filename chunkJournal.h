@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "chunkScheduler.h"
+
+// What the journal remembers about a partially downloaded file
+struct JournalState {
+    std::string url;
+    int64_t size;
+    std::string etag;
+    std::string last_modified;
+    int64_t chunk_size;
+    std::vector<ByteRange> completed;
+};
+
+// Small JSON file next to the output ("<output>.mush") recording which byte
+// ranges are already on disk and the validators of the resource they came
+// from, so an interrupted download only fetches what is missing.
+class ChunkJournal {
+public:
+    explicit ChunkJournal(const std::string& output);
+
+    bool load(JournalState& state) const;
+
+    // Atomic, durable replace: a crash mid-save leaves the previous journal
+    // intact
+    bool save(const JournalState& state) const;
+
+    void remove() const;
+
+    const std::string& path() const { return journal_path; }
+
+private:
+    std::string journal_path;
+};
@@ -0,0 +1,254 @@
+#include "chunkScheduler.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+const int64_t kMinChunkSize = 256 * 1024;
+const int64_t kMaxChunkSize = 4 * 1024 * 1024;
+const int64_t kChunksPerInterface = 8;
+
+} // namespace
+
+int64_t default_chunk_size(int64_t size, size_t interfaces) {
+    if (interfaces == 0) interfaces = 1;
+    int64_t chunk = size / (static_cast<int64_t>(interfaces) * kChunksPerInterface);
+    return std::max(kMinChunkSize, std::min(kMaxChunkSize, chunk));
+}
+
+ChunkScheduler::ChunkScheduler(int64_t size, const std::vector<double>& weights, int64_t chunk_size)
+    : lane_weights(weights),
+      total(size),
+      done(0),
+      chunk_bytes(std::max<int64_t>(1, chunk_size)),
+      window(0) {
+    double total_weight = 0;
+    for (double w : weights) {
+        total_weight += w;
+    }
+
+    // Initial lanes follow the measured scores; stealing corrects them later
+    int64_t start = 0;
+    for (size_t i = 0; i < weights.size(); i++) {
+        double share = total_weight > 0 ? weights[i] / total_weight : 1.0 / weights.size();
+        int64_t end = (i + 1 == weights.size())
+            ? size - 1
+            : std::min(size - 1, start + static_cast<int64_t>(size * share) - 1);
+        lanes.push_back({start, end});
+        if (end >= start) start = end + 1;
+    }
+}
+
+ChunkScheduler::ChunkScheduler(int64_t size, const std::vector<ByteRange>& done_ranges,
+                               size_t lane_count, int64_t chunk_size)
+    : lanes(lane_count, ByteRange{0, -1}),
+      lane_weights(lane_count, 1.0),
+      total(size),
+      done(0),
+      chunk_bytes(std::max<int64_t>(1, chunk_size)),
+      window(0) {
+    for (const auto& range : done_ranges) {
+        add_completed({std::max<int64_t>(0, range.start), std::min(size - 1, range.end)});
+    }
+
+    int64_t pos = 0;
+    auto queue_gap = [this](int64_t start, int64_t end) {
+        for (int64_t s = start; s <= end; s += chunk_bytes) {
+            retry.push_back({{s, std::min(end, s + chunk_bytes - 1)}, kNoLane});
+        }
+    };
+    for (const auto& range : completed) {
+        if (range.first > pos) queue_gap(pos, range.first - 1);
+        pos = std::max(pos, range.second + 1);
+    }
+    if (pos < size) queue_gap(pos, size - 1);
+}
+
+bool ChunkScheduler::next(size_t lane, ByteRange& chunk) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (window > 0) return next_in_order(lane, chunk);
+
+    for (auto it = retry.begin(); it != retry.end(); ++it) {
+        if (it->avoid_lane != lane) {
+            chunk = it->chunk;
+            retry.erase(it);
+            return true;
+        }
+    }
+
+    if (lane >= lanes.size() || (lanes[lane].length() <= 0 && !steal(lane))) {
+        // Only chunks this lane should avoid are left; better than none
+        if (retry.empty()) return false;
+        chunk = retry.front().chunk;
+        retry.pop_front();
+        return true;
+    }
+
+    ByteRange& own = lanes[lane];
+    int64_t end = std::min(own.end, own.start + chunk_bytes - 1);
+    chunk = {own.start, end};
+    own.start = end + 1;
+    return true;
+}
+
+bool ChunkScheduler::next_in_order(size_t lane, ByteRange& chunk) {
+    int64_t head = first_missing();
+    int64_t limit = (consumed ? std::min(head, consumed()) : head) + window;
+    // The lowest chunk this lane need not avoid, else the lowest of all
+    auto avoided = ordered.end();
+    for (auto it = ordered.begin(); it != ordered.end() && it->first < limit; ++it) {
+        if (it->second.avoid_lane != lane || it->first <= head) {
+            chunk = it->second.chunk;
+            ordered.erase(it);
+            return true;
+        }
+        if (avoided == ordered.end()) avoided = it;
+    }
+    if (avoided == ordered.end()) return false;
+    chunk = avoided->second.chunk;
+    ordered.erase(avoided);
+    return true;
+}
+
+void ChunkScheduler::set_window(int64_t bytes, std::function<int64_t()> reader) {
+    std::lock_guard<std::mutex> lock(mutex);
+    window = bytes;
+    consumed = reader;
+    for (const auto& entry : retry) {
+        ordered[entry.chunk.start] = entry;
+    }
+    retry.clear();
+}
+
+bool ChunkScheduler::held_back() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return window > 0 && !ordered.empty();
+}
+
+// Start of the first byte not yet written
+int64_t ChunkScheduler::first_missing() const {
+    auto first = completed.begin();
+    return first != completed.end() && first->first == 0 ? first->second + 1 : 0;
+}
+
+bool ChunkScheduler::steal(size_t lane) {
+    size_t victim = lanes.size();
+    int64_t largest = 0;
+    for (size_t i = 0; i < lanes.size(); i++) {
+        if (i != lane && lanes[i].length() > largest) {
+            largest = lanes[i].length();
+            victim = i;
+        }
+    }
+    if (victim == lanes.size()) return false;
+
+    ByteRange& from = lanes[victim];
+    if (largest >= 2 * chunk_bytes) {
+        // Take the tail so the victim keeps reading sequentially; a faster
+        // thief takes a proportionally larger share
+        double thief_weight = lane_weights[lane];
+        double victim_weight = lane_weights[victim];
+        double share = thief_weight > 0 && victim_weight > 0
+            ? thief_weight / (thief_weight + victim_weight)
+            : 0.5;
+        int64_t taken = static_cast<int64_t>(largest * share);
+        taken = std::max(chunk_bytes, std::min(largest - chunk_bytes, taken));
+        int64_t mid = from.end + 1 - taken;
+        lanes[lane] = {mid, from.end};
+        from.end = mid - 1;
+    } else {
+        lanes[lane] = from;
+        from.start = from.end + 1;
+    }
+    return true;
+}
+
+void ChunkScheduler::set_weights(const std::vector<double>& weights) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (weights.size() == lane_weights.size()) lane_weights = weights;
+}
+
+void ChunkScheduler::complete(const ByteRange& chunk) {
+    std::lock_guard<std::mutex> lock(mutex);
+    add_completed(chunk);
+}
+
+void ChunkScheduler::add_completed(const ByteRange& range) {
+    if (range.length() <= 0) return;
+    int64_t start = range.start;
+    int64_t end = range.end;
+
+    // Merge with any neighbour that overlaps or touches
+    auto it = completed.upper_bound(start);
+    if (it != completed.begin()) {
+        auto prev = std::prev(it);
+        if (prev->second + 1 >= start) {
+            start = prev->first;
+            it = prev;
+        }
+    }
+    while (it != completed.end() && it->first <= end + 1) {
+        end = std::max(end, it->second);
+        done -= it->second - it->first + 1;
+        it = completed.erase(it);
+    }
+    completed[start] = end;
+    done += end - start + 1;
+}
+
+void ChunkScheduler::requeue(const ByteRange& chunk, size_t avoid_lane) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (chunk.length() <= 0) return;
+    if (window > 0) {
+        ordered[chunk.start] = {chunk, avoid_lane};
+    } else {
+        retry.push_back({chunk, avoid_lane});
+    }
+}
+
+void ChunkScheduler::discard(const ByteRange& range) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (range.length() <= 0) return;
+
+    // Cut [start, end] out of every completed range it overlaps
+    auto it = completed.upper_bound(range.start);
+    if (it != completed.begin()) --it;
+    while (it != completed.end() && it->first <= range.end) {
+        int64_t first = it->first;
+        int64_t last = it->second;
+        if (last < range.start) {
+            ++it;
+            continue;
+        }
+        it = completed.erase(it);
+        done -= last - first + 1;
+        if (first < range.start) {
+            completed[first] = range.start - 1;
+            done += range.start - first;
+        }
+        if (last > range.end) {
+            completed[range.end + 1] = last;
+            done += last - range.end;
+        }
+    }
+}
+
+bool ChunkScheduler::finished() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return done >= total;
+}
+
+int64_t ChunkScheduler::completed_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return done;
+}
+
+std::vector<ByteRange> ChunkScheduler::completed_ranges() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ByteRange> ranges;
+    for (const auto& range : completed) {
+        ranges.push_back({range.first, range.second});
+    }
+    return ranges;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+// Inclusive byte range [start, end] of the remote file
+struct ByteRange {
+    int64_t start;
+    int64_t end;
+
+    int64_t length() const { return end - start + 1; }
+};
+
+// No particular lane, e.g. for bytes kept from an earlier run
+const size_t kNoLane = static_cast<size_t>(-1);
+
+// Hands out small chunks of the file to interface workers. Each interface
+// starts with a contiguous lane sized by its weight and pulls chunks off the
+// front of it; once its lane is empty it steals the tail of the largest
+// remaining lane, so a fast link never sits idle while a slow one drags.
+// The stolen share follows the current weights of thief and victim.
+class ChunkScheduler {
+public:
+    ChunkScheduler(int64_t size, const std::vector<double>& weights, int64_t chunk_size);
+
+    // Resume: only the bytes outside completed are fetched. The gaps are cut
+    // into chunks in a shared queue that every worker pulls from.
+    ChunkScheduler(int64_t size, const std::vector<ByteRange>& completed, size_t lane_count,
+                   int64_t chunk_size);
+
+    // Next chunk for the worker of the given lane; false when nothing is left
+    bool next(size_t lane, ByteRange& chunk);
+
+    void complete(const ByteRange& chunk);
+
+    // Live per-lane weights (e.g. from the monitor daemon) for future steals
+    void set_weights(const std::vector<double>& weights);
+
+    // Stream order, for output consumed front to back (use the resume
+    // constructor, whose single queue is in file order): the lowest chunk
+    // goes first, the one at the first missing byte even to a lane that
+    // should avoid it, and none starts window bytes or more past that byte,
+    // which bounds what has to wait in memory for the gap to close.
+    // consumed, if given, reports how far the consumer has read; the window
+    // then never runs ahead of it either, so a slow reader holds the
+    // workers back instead of filling memory.
+    void set_window(int64_t bytes, std::function<int64_t()> consumed = nullptr);
+
+    // Chunks are left, but all of them lie beyond the window for now
+    bool held_back() const;
+
+    // Return an unfinished chunk so any worker can pick it up. The worker of
+    // avoid_lane only takes it when it has nothing else left to fetch.
+    void requeue(const ByteRange& chunk, size_t avoid_lane = kNoLane);
+
+    // Forget completed bytes that turned out to be bad
+    void discard(const ByteRange& range);
+
+    bool finished() const;
+    int64_t completed_bytes() const;
+
+    // Merged list of every byte range written so far
+    std::vector<ByteRange> completed_ranges() const;
+
+    int64_t chunk_size() const { return chunk_bytes; }
+
+private:
+    struct Retry {
+        ByteRange chunk;
+        size_t avoid_lane;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<ByteRange> lanes;
+    std::vector<double> lane_weights;
+    std::deque<Retry> retry;
+    std::map<int64_t, Retry> ordered;   // stream order: the queue by start
+    std::map<int64_t, int64_t> completed;
+    int64_t total;
+    int64_t done;
+    int64_t chunk_bytes;
+    int64_t window;
+    std::function<int64_t()> consumed;
+
+    bool steal(size_t lane);
+    bool next_in_order(size_t lane, ByteRange& chunk);
+    int64_t first_missing() const;
+    void add_completed(const ByteRange& range);
+};
+
+// Chunk size giving every interface several chunks to balance with, capped
+// so large files are not split into needlessly many requests
+int64_t default_chunk_size(int64_t size, size_t interfaces);
@@ -0,0 +1,84 @@
+#include "connectionTuner.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace {
+
+// Seconds of traffic per measurement; long enough for TCP slow start
+const double kWindowSeconds = 2.0;
+// Relative gain an extra connection must bring to be kept
+const double kMinGain = 1.10;
+// A drop this large means conditions changed, so probe again right away
+const double kDropRatio = 0.70;
+// Windows to hold a plateau before trying one more connection
+const int kHoldWindows = 5;
+
+} // namespace
+
+ConnectionTuner::ConnectionTuner(int initial, int maximum)
+    : current(std::max(1, initial)),
+      maximum(std::max(1, maximum)),
+      server_cap(INT_MAX),
+      window_start(0),
+      window_bytes(0),
+      last_rate(0),
+      climbing(false),
+      hold_windows(0) {
+    current = std::min(current, this->maximum);
+}
+
+bool ConnectionTuner::sample(double seconds, int64_t total_bytes) {
+    double elapsed = seconds - window_start;
+    if (elapsed < kWindowSeconds) return false;
+
+    double rate = (total_bytes - window_bytes) / elapsed;
+    window_start = seconds;
+    window_bytes = total_bytes;
+
+    int previous = current;
+    if (last_rate <= 0) {
+        // First full window is the baseline
+        climbing = current < maximum;
+        if (climbing) current++;
+    } else if (climbing) {
+        if (rate >= last_rate * kMinGain && current < maximum) {
+            current++;
+        } else if (rate < last_rate * kMinGain) {
+            // The last connection did not pay for itself
+            current = std::max(1, current - 1);
+            climbing = false;
+            hold_windows = 0;
+        } else {
+            climbing = false;
+            hold_windows = 0;
+        }
+    } else if (rate < last_rate * kDropRatio || ++hold_windows >= kHoldWindows) {
+        hold_windows = 0;
+        climbing = current < maximum;
+        if (climbing) current++;
+    }
+
+    last_rate = rate;
+    return current != previous;
+}
+
+void ConnectionTuner::throttled() {
+    server_cap = std::max(1, current - 1);
+    maximum = std::min(maximum, server_cap);
+    current = maximum;
+    climbing = false;
+    hold_windows = 0;
+}
+
+void ConnectionTuner::set_maximum(int limit) {
+    maximum = std::min(std::max(1, limit), server_cap);
+    if (current > maximum) {
+        current = maximum;
+        climbing = false;
+        hold_windows = 0;
+    } else if (current < maximum && !climbing) {
+        // Room was freed: probe it on the next window
+        hold_windows = kHoldWindows;
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+// Picks how many concurrent range connections one interface should run.
+// Hill-climbs: adds a connection while each addition still raises the
+// interface's throughput, backs off one step once the gain flattens, and
+// caps the count when the server pushes back (429/503).
+class ConnectionTuner {
+public:
+    ConnectionTuner(int initial, int maximum);
+
+    int target() const { return current; }
+
+    // Feed the interface's cumulative byte count; returns true when the
+    // target changed
+    bool sample(double seconds, int64_t total_bytes);
+
+    // Server throttled us: drop a connection and never climb past that again
+    void throttled();
+
+    // New ceiling from outside (e.g. the download queue sharing interfaces
+    // between jobs); a cap learned from throttling still applies
+    void set_maximum(int limit);
+
+private:
+    int current;
+    int maximum;
+    int server_cap;
+    double window_start;
+    int64_t window_bytes;
+    double last_rate;
+    bool climbing;
+    int hold_windows;
+};
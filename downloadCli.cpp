@@ -0,0 +1,323 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <csignal>
+#include <json/json.h>
+#include "downloadEngine.h"
+#include "metalink.h"
+#include "hostHistory.h"
+
+// Headless front end: one download, no GTK. Every event is written to
+// stdout as one JSON object per line so pipelines can follow progress;
+// when the download itself streams to stdout (-o -) events go to stderr.
+
+namespace {
+
+DownloadEngine* g_engine = nullptr;
+std::mutex g_output_mutex;
+std::ostream* g_events = &std::cout;
+
+void onSignal(int) {
+    // Only flips an atomic flag; the engine unwinds and saves its journal
+    if (g_engine) g_engine->stop();
+}
+
+void emit(const Json::Value& event) {
+    Json::FastWriter writer;
+    std::lock_guard<std::mutex> lock(g_output_mutex);
+    *g_events << writer.write(event) << std::flush;
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+// Last path segment of the URL, without query, as the default file name
+std::string defaultOutput(const std::string& url) {
+    std::string path = url.substr(0, url.find_first_of("?#"));
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    if (name.empty() || path.find("://") + 2 == slash) return "download";
+    return name;
+}
+
+void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [-o OUTPUT] [-i IFACE,IFACE...] [--networks FILE]"
+              << " [--connections N] [--chunk-size BYTES] [--monitor-socket PATH]"
+              << " [--progress-interval SECONDS] [--verify] [--sha256 HEX]"
+              << " [--http auto|1.1|2|3] [--stall-timeout SECONDS] [--min-rate BYTES] [--no-io-uring]"
+              << " [--reorder-buffer BYTES] [--trace FILE] [--metrics-port PORT]"
+              << " [--history FILE|--no-history] [--system-dns]"
+              << " [--metalink FILE] URL [MIRROR_URL...]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> urls;
+    std::string metalink_path;
+    int64_t expected_size = -1;
+    std::string output;
+    std::string networks_path = "networks.json";
+    std::vector<std::string> names;
+    int max_connections = kDefaultMaxConnections;
+    int64_t chunk_size = 0;
+    std::string monitor_socket = kDefaultMonitorSocket;
+    double progress_interval = 1.0;
+    bool verify = false;
+    std::string expected_sha256;
+    HttpMode http_mode = HttpMode::Auto;
+    int stall_seconds = kDefaultStallSeconds;
+    int64_t stall_rate = kDefaultStallRate;
+    bool io_uring = true;
+    int64_t reorder_buffer = kDefaultReorderBuffer;
+    std::string trace_path;
+    int metrics_port = 0;
+    std::string history_path = kDefaultHistoryFile;
+    bool edge_selection = true;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+            output = argv[++i];
+        } else if ((arg == "-i" || arg == "--interfaces") && i + 1 < argc) {
+            names = splitList(argv[++i]);
+        } else if (arg == "--networks" && i + 1 < argc) {
+            networks_path = argv[++i];
+        } else if (arg == "--connections" && i + 1 < argc) {
+            max_connections = std::atoi(argv[++i]);
+            if (max_connections <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--chunk-size" && i + 1 < argc) {
+            chunk_size = std::atoll(argv[++i]);
+            if (chunk_size <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--monitor-socket" && i + 1 < argc) {
+            monitor_socket = argv[++i];
+        } else if (arg == "--progress-interval" && i + 1 < argc) {
+            progress_interval = std::atof(argv[++i]);
+            if (progress_interval <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg == "--sha256" && i + 1 < argc) {
+            expected_sha256 = argv[++i];
+            if (expected_sha256.size() != 64
+                || expected_sha256.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+                std::cerr << "--sha256 needs 64 hex digits" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--http" && i + 1 < argc) {
+            std::string version = argv[++i];
+            if (version == "auto") {
+                http_mode = HttpMode::Auto;
+            } else if (version == "1.1") {
+                http_mode = HttpMode::Http1;
+            } else if (version == "2") {
+                http_mode = HttpMode::Http2;
+            } else if (version == "3") {
+                http_mode = HttpMode::Http3;
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--stall-timeout" && i + 1 < argc) {
+            stall_seconds = std::atoi(argv[++i]);
+            if (stall_seconds < 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--min-rate" && i + 1 < argc) {
+            stall_rate = std::atoll(argv[++i]);
+            if (stall_rate <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--reorder-buffer" && i + 1 < argc) {
+            reorder_buffer = std::atoll(argv[++i]);
+            if (reorder_buffer <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--no-io-uring") {
+            io_uring = false;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            metrics_port = std::atoi(argv[++i]);
+            if (metrics_port <= 0 || metrics_port > 65535) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--history" && i + 1 < argc) {
+            history_path = argv[++i];
+        } else if (arg == "--no-history") {
+            history_path.clear();
+        } else if (arg == "--system-dns") {
+            edge_selection = false;
+        } else if (arg == "--metalink" && i + 1 < argc) {
+            metalink_path = argv[++i];
+        } else if (arg[0] != '-') {
+            urls.push_back(arg);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    // Mirrors from a metalink come after any URLs given on the command line
+    std::string error;
+    if (!metalink_path.empty()) {
+        MetalinkFile metalink;
+        if (!load_metalink(metalink_path, metalink, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        urls.insert(urls.end(), metalink.urls.begin(), metalink.urls.end());
+        if (output.empty() && !metalink.name.empty()) {
+            // Base name only; the metalink does not choose the directory
+            output = metalink.name.substr(metalink.name.find_last_of('/') + 1);
+        }
+        if (expected_sha256.empty()) expected_sha256 = metalink.sha256;
+        expected_size = metalink.size;
+    }
+    if (urls.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (output.empty()) output = defaultOutput(urls[0]);
+    if (output == "-") g_events = &std::cerr;
+    if (!expected_sha256.empty()) verify = true;
+
+    // Measured interfaces when available, otherwise every local interface
+    // with an equal share
+    std::vector<NetworkInterface> networks;
+    if (!load_networks(networks_path, networks, error)) {
+        networks = unmeasured_interfaces();
+    }
+    if (!names.empty()) networks = select_interfaces(networks, names);
+    if (networks.empty()) {
+        std::cerr << "No network interfaces to download with" << std::endl;
+        return 1;
+    }
+
+    DownloadEngine engine(networks);
+    engine.set_connections(std::min(kDefaultInitialConnections, max_connections), max_connections);
+    engine.set_chunk_size(chunk_size);
+    engine.set_monitor_socket(monitor_socket);
+    engine.set_verification(verify, expected_sha256);
+    engine.set_expected_size(expected_size);
+    engine.set_http_mode(http_mode);
+    engine.set_stall_limit(stall_seconds, stall_rate);
+    engine.set_io_uring(io_uring);
+    engine.set_reorder_buffer(reorder_buffer);
+    engine.set_history_file(history_path);
+    engine.set_edge_selection(edge_selection);
+    if (!trace_path.empty() && !engine.set_trace_file(trace_path, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    // Scraped while the download runs; gone when it exits
+    MetricsEndpoint endpoint;
+    if (metrics_port > 0
+        && !endpoint.start(metrics_port, [&engine]() { return engine.metrics_text(); }, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    engine.set_log_callback([](const std::string& text) {
+        Json::Value event;
+        event["event"] = "log";
+        event["message"] = text;
+        emit(event);
+    });
+
+    auto started = std::chrono::steady_clock::now();
+    auto last_report = started - std::chrono::hours(1);
+    int64_t last_downloaded = -1;
+    engine.set_progress_callback([&engine, &last_report, &last_downloaded, progress_interval, started, verify](
+            int64_t downloaded, int64_t total) {
+        // Throttled, but the final count is always reported exactly once
+        auto now = std::chrono::steady_clock::now();
+        bool last = total >= 0 && downloaded >= total;
+        if (downloaded == last_downloaded) return;
+        if (!last && std::chrono::duration<double>(now - last_report).count() < progress_interval) return;
+        last_report = now;
+        last_downloaded = downloaded;
+
+        DownloadProgress progress = engine.progress();
+        Json::Value event;
+        event["event"] = "progress";
+        event["downloaded"] = Json::Int64(downloaded);
+        event["total"] = Json::Int64(total);
+        if (total > 0) event["percent"] = 100.0 * downloaded / total;
+        event["elapsed"] = std::chrono::duration<double>(now - started).count();
+        event["rate"] = progress.rate;
+        event["eta"] = progress.eta;
+        if (verify) event["verified"] = Json::Int64(progress.verified);
+        for (const auto& lane : progress.interfaces) {
+            Json::Value iface;
+            iface["interface"] = lane.interface;
+            iface["bytes"] = Json::Int64(lane.bytes);
+            iface["rate"] = lane.rate;
+            iface["connections"] = lane.connections;
+            event["interfaces"].append(iface);
+        }
+        emit(event);
+    });
+
+    g_engine = &engine;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    // A reader that quits early shows up as a failed write, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    Json::Value start;
+    start["event"] = "start";
+    start["url"] = urls[0];
+    for (size_t i = 1; i < urls.size(); i++) {
+        start["mirrors"].append(urls[i]);
+    }
+    start["output"] = output;
+    for (const auto& net : networks) {
+        start["interfaces"].append(net.interface);
+    }
+    emit(start);
+
+    bool ok = engine.run(urls, output);
+    g_engine = nullptr;
+    endpoint.stop();
+
+    Json::Value done;
+    done["event"] = "finished";
+    done["ok"] = ok;
+    done["stopped"] = engine.stopped();
+    done["output"] = output;
+    // Exact per-interface totals: every worker has exited by now
+    DownloadProgress progress = engine.progress();
+    done["downloaded"] = Json::Int64(progress.downloaded);
+    if (!engine.sha256().empty()) done["sha256"] = engine.sha256();
+    for (const auto& lane : progress.interfaces) {
+        Json::Value iface;
+        iface["interface"] = lane.interface;
+        iface["bytes"] = Json::Int64(lane.bytes);
+        done["interfaces"].append(iface);
+    }
+    emit(done);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,1623 @@
+#include "downloadEngine.h"
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <cmath>
+#include <map>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "connectionTuner.h"
+#include "interfaceInfo.h"
+#include "routingManager.h"
+#include "streamVerifier.h"
+#include "writeRing.h"
+#include "hostHistory.h"
+#include "edgeResolver.h"
+
+namespace {
+
+std::once_flag curl_init_flag;
+
+void ensure_curl_initialized() {
+    std::call_once(curl_init_flag, []() { curl_global_init(CURL_GLOBAL_ALL); });
+}
+
+// libcurl's receive buffer; larger blocks mean fewer write callbacks and
+// fewer pwrite calls per chunk
+const long kReceiveBufferSize = 512 * 1024;
+
+// Write buffers per interface when disk writes go through io_uring; one is
+// staging each transfer's bytes while others are being written out
+const size_t kRingBuffers = 16;
+const size_t kRingBufferSize = 256 * 1024;
+
+// Smallest chunk a streamed download splits into; a smaller reorder buffer
+// means fewer connections instead
+const int64_t kMinStreamChunk = 64 * 1024;
+
+// Destination of one transfer: bytes land in file starting at offset and
+// must not go past end (inclusive, -1 when the size is unknown)
+struct RangeWriter {
+    CURL* curl;
+    OutputFile* file;
+    int64_t offset;
+    int64_t end;
+    bool checked_status;
+    bool accept_full;
+    bool failed;
+    int64_t* received;
+    bool checksum;      // keep a CRC32 of the written bytes in crc
+    uint32_t crc;
+    Sha256* hash;       // sequential writes only: hash the bytes on the way
+    WriteRing* ring;    // stage writes here instead of writing them at once
+    RingStream stream;  // offset counts staged bytes until the ring drains
+};
+
+// One range request slot on an interface; the easy handle is reused for
+// every chunk the slot fetches, from whichever mirror the chunk goes to
+struct Transfer {
+    CURL* curl;
+    RangeWriter writer;
+    ByteRange chunk;
+    size_t mirror;
+    std::string range_spec;
+    bool active;
+    bool settling;      // done on the network, its writes still in flight
+    CURLcode result;
+};
+
+// How one mirror performs when reached through one interface
+struct MirrorLink {
+    double rate;            // bytes/s of a single transfer, smoothed; 0 until measured
+    int active;
+    int chunks;
+    int failures;           // consecutive
+    int64_t bytes;
+    bool dropped;
+    bool slow;              // dropped for its rate, not for failing
+    struct curl_slist* headers;
+};
+
+// Consecutive failed chunks after which an interface is taken offline
+const int kMaxConsecutiveFailures = 3;
+
+// How often a working interface checks that its link is still there
+const int kLinkCheckMilliseconds = 1000;
+
+// An offline interface is re-probed after pauses that double from the
+// minimum to the maximum, and left out once it has been down for the limit
+const int kRecheckMinSeconds = 2;
+const int kRecheckMaxSeconds = 30;
+const int kMaxOfflineSeconds = 300;
+const long kRecheckTimeoutSeconds = 10;
+
+// How often the chunk journal is flushed while a download runs
+const int kJournalIntervalSeconds = 2;
+
+// Weight of the newest sample in the smoothed progress rates
+const double kRateSmoothing = 0.3;
+
+// Times a byte range may fail verification before it is left missing
+const int kMaxChunkMismatches = 3;
+
+// An interface stops using a mirror whose transfers run below this share of
+// its best mirror's, once both have finished a few chunks
+const double kSlowMirrorRatio = 0.2;
+const int kMinMirrorChunks = 2;
+
+// Shorter stints than this measure the ramp more than the path
+const int64_t kMinHistoryBytes = 4 * 1024 * 1024;
+const double kMinHistorySeconds = 1.0;
+
+// Clears a flag on every way out of a scope
+struct ClearOnExit {
+    std::atomic<bool>& flag;
+    ~ClearOnExit() { flag = false; }
+};
+
+size_t write_callback(char* ptr, size_t size, size_t nmemb, void* userdata) {
+    RangeWriter* w = static_cast<RangeWriter*>(userdata);
+    size_t len = size * nmemb;
+
+    if (!w->checked_status) {
+        w->checked_status = true;
+        long code = 0;
+        curl_easy_getinfo(w->curl, CURLINFO_RESPONSE_CODE, &code);
+        // A 200 to a range request is the whole file; only usable from byte 0,
+        // and never under If-Range, where it means the resource changed
+        if (code != 206 && !(code == 200 && w->offset == 0 && w->accept_full)) {
+            w->failed = true;
+            return 0;
+        }
+    }
+
+    size_t usable = len;
+    if (w->end >= 0) {
+        int64_t remaining = w->end + 1 - w->offset;
+        if (remaining <= 0) return 0;
+        if (static_cast<int64_t>(usable) > remaining) usable = static_cast<size_t>(remaining);
+    }
+
+    bool written = w->ring ? !w->stream.failed && w->ring->write(w->stream, ptr, usable, w->offset)
+                           : w->file->write_at(ptr, usable, w->offset);
+    if (!written) {
+        w->failed = true;
+        return 0;
+    }
+    if (w->checksum) w->crc = crc32_update(w->crc, ptr, usable);
+    if (w->hash) w->hash->update(ptr, usable);
+    w->offset += usable;
+    if (w->received) *w->received += usable;
+
+    // Stop the transfer once the range is filled (server ignored the range)
+    return usable == len ? len : 0;
+}
+
+int progress_callback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+    return static_cast<DownloadEngine*>(clientp)->stopped() ? 1 : 0;
+}
+
+// Collects the validators of the final response (earlier ones are redirects)
+size_t header_callback(char* buffer, size_t size, size_t nitems, void* userdata) {
+    RemoteInfo* remote = static_cast<RemoteInfo*>(userdata);
+    size_t len = size * nitems;
+    std::string line(buffer, len);
+    while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) line.pop_back();
+
+    if (line.compare(0, 5, "HTTP/") == 0) {
+        // A new response (e.g. after a redirect) replaces everything so far
+        remote->size = -1;
+        remote->etag.clear();
+        remote->last_modified.clear();
+        return len;
+    }
+
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) return len;
+    std::string name = line.substr(0, colon);
+    for (auto& c : name) c = static_cast<char>(tolower(c));
+    size_t value_start = line.find_first_not_of(' ', colon + 1);
+    std::string value = value_start == std::string::npos ? "" : line.substr(value_start);
+
+    if (name == "etag") {
+        remote->etag = value;
+    } else if (name == "last-modified") {
+        remote->last_modified = value;
+    } else if (name == "content-range") {
+        // "bytes 0-0/12345"; the total is "*" when the server does not know it
+        size_t slash = value.rfind('/');
+        if (slash != std::string::npos && value.compare(slash + 1, 1, "*") != 0) {
+            remote->size = std::strtoll(value.c_str() + slash + 1, nullptr, 10);
+        }
+    }
+    return len;
+}
+
+// Body of the probe: the single byte of a 206 is fine, but a 200 means the
+// server ignored the range and is sending the whole file, so stop it at once
+size_t probe_body_callback(char*, size_t size, size_t nmemb, void* userdata) {
+    long code = 0;
+    curl_easy_getinfo(static_cast<CURL*>(userdata), CURLINFO_RESPONSE_CODE, &code);
+    return code == 206 ? size * nmemb : 0;
+}
+
+void setup_handle(CURL* curl, const std::string& url, long http_version, int stall_seconds,
+                  int64_t stall_rate, DownloadEngine* engine) {
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, http_version);
+    // Queue behind a connection that may multiplex rather than open another
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    if (stall_seconds > 0) {
+        // Also catches links that vanish without a reset and would hang forever
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, static_cast<long>(std::max<int64_t>(1, stall_rate)));
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, static_cast<long>(stall_seconds));
+    }
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mush/1.0");
+    curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, kReceiveBufferSize);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_callback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, engine);
+}
+
+void start_transfer(CURLM* multi, Transfer& t, OutputFile& file, const ByteRange& chunk,
+                    const std::string& url, struct curl_slist* headers, bool accept_full,
+                    int64_t* received, bool checksum, WriteRing* ring) {
+    std::ostringstream range_spec;
+    range_spec << chunk.start << "-" << chunk.end;
+    t.range_spec = range_spec.str();
+    t.chunk = chunk;
+    t.writer = {t.curl, &file, chunk.start, chunk.end, false, accept_full, false, received,
+                checksum, 0, nullptr, ring, RingStream()};
+    t.active = true;
+    t.settling = false;
+
+    curl_easy_setopt(t.curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(t.curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(t.curl, CURLOPT_RANGE, t.range_spec.c_str());
+    curl_easy_setopt(t.curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, &t.writer);
+    curl_multi_add_handle(multi, t.curl);
+}
+
+// Next mirror for a chunk on one interface. An unmeasured mirror gets one
+// trial transfer; after that the chunk goes where it would finish soonest,
+// given each mirror's per-transfer rate and the transfers already on it.
+size_t pick_mirror(const std::vector<MirrorLink>& links) {
+    size_t best = links.size();
+    double best_cost = 0;
+    for (size_t i = 0; i < links.size(); i++) {
+        const MirrorLink& link = links[i];
+        if (link.dropped) continue;
+        if (link.rate <= 0) {
+            if (link.active == 0) return i;
+            continue;
+        }
+        double cost = (link.active + 1) / link.rate;
+        if (best == links.size() || cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+    if (best != links.size()) return best;
+
+    // Only trials in flight: queue behind the least busy one
+    for (size_t i = 0; i < links.size(); i++) {
+        if (!links[i].dropped && (best == links.size() || links[i].active < links[best].active)) best = i;
+    }
+    return best;
+}
+
+// A mirror whose transfers are far slower than the best one's, once both
+// have a few chunks behind them; links.size() when there is none
+size_t slow_mirror(const std::vector<MirrorLink>& links) {
+    double best = 0;
+    for (const auto& link : links) {
+        if (!link.dropped && link.chunks >= kMinMirrorChunks) best = std::max(best, link.rate);
+    }
+    for (size_t i = 0; i < links.size(); i++) {
+        const MirrorLink& link = links[i];
+        if (!link.dropped && link.chunks >= kMinMirrorChunks && link.rate < best * kSlowMirrorRatio) {
+            return i;
+        }
+    }
+    return links.size();
+}
+
+// An interface can carry chunks while its link is up and, if it had an
+// address when the download started, it still has one
+bool link_usable(const std::string& iface, bool needs_address) {
+    return interface_up(iface) && (!needs_address || !interface_ipv4(iface).empty());
+}
+
+// Host name and port a URL connects to; false for address literals and
+// unknown schemes, which have nothing to resolve
+bool url_endpoint(const std::string& url, std::string& host, int& port) {
+    std::string authority = url_host(url);
+    if (authority.empty() || authority[0] == '[') return false;
+    size_t colon = authority.find(':');
+    host = authority.substr(0, colon);
+    if (host.find_first_not_of("0123456789.") == std::string::npos) return false;
+    if (colon != std::string::npos) {
+        port = std::atoi(authority.c_str() + colon + 1);
+    } else if (url.compare(0, 8, "https://") == 0) {
+        port = 443;
+    } else if (url.compare(0, 7, "http://") == 0) {
+        port = 80;
+    } else {
+        return false;
+    }
+    return !host.empty() && port > 0;
+}
+
+const char* http_version_name(long version) {
+    switch (version) {
+    case CURL_HTTP_VERSION_1_0: return "HTTP/1.0";
+    case CURL_HTTP_VERSION_1_1: return "HTTP/1.1";
+    case CURL_HTTP_VERSION_2_0: return "HTTP/2";
+    case CURL_HTTP_VERSION_3: return "HTTP/3";
+    default: return "HTTP";
+    }
+}
+
+// Resume is only safe when the journal was written for one of the same
+// URLs and the resource provably has not changed
+bool validators_match(const JournalState& previous, const RemoteInfo& remote,
+                      const std::vector<std::string>& urls) {
+    if (std::find(urls.begin(), urls.end(), previous.url) == urls.end()) return false;
+    if (previous.size != remote.size) return false;
+    if (!previous.etag.empty() && previous.etag == remote.etag) return true;
+    return !previous.last_modified.empty() && previous.last_modified == remote.last_modified;
+}
+
+// If-Range needs a strong ETag; fall back to the modification date
+std::string if_range_value(const RemoteInfo& remote) {
+    if (!remote.etag.empty() && remote.etag.compare(0, 2, "W/") != 0) return remote.etag;
+    return remote.last_modified;
+}
+
+} // namespace
+
+struct DownloadEngine::ConnectionPool {
+    CURLSH* share;
+    std::mutex locks[CURL_LOCK_DATA_LAST];
+    curl_slist* pins;   // CURLOPT_RESOLVE entries for the interface's edges
+    std::mutex peers_mutex;
+    std::map<std::string, std::string> peers;  // "host:port" -> address connected to
+
+    ConnectionPool() : share(curl_share_init()), pins(nullptr) {
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    }
+    ~ConnectionPool() {
+        curl_share_cleanup(share);
+        curl_slist_free_all(pins);
+    }
+
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+        static_cast<ConnectionPool*>(userptr)->locks[data].lock();
+    }
+
+    static void unlock(CURL*, curl_lock_data data, void* userptr) {
+        static_cast<ConnectionPool*>(userptr)->locks[data].unlock();
+    }
+};
+
+DownloadEngine::DownloadEngine(const std::vector<NetworkInterface>& networks)
+    : networks(networks),
+      lanes(new LaneCounters[networks.size()]),
+      running(false),
+      downloaded(0),
+      total(-1),
+      rate(0),
+      verified(0),
+      stopping(false),
+      chunk_size(0),
+      initial_connections(kDefaultInitialConnections),
+      max_connections(kDefaultMaxConnections),
+      stream_connections(0),
+      stall_seconds(kDefaultStallSeconds),
+      stall_rate(kDefaultStallRate),
+      busy_lanes(0),
+      use_io_uring(true),
+      reorder_buffer(kDefaultReorderBuffer),
+      monitor_socket(kDefaultMonitorSocket),
+      history_path(kDefaultHistoryFile),
+      edge_selection(true),
+      http_mode(HttpMode::Auto),
+      http_version(CURL_HTTP_VERSION_2TLS),
+      multiplexed(false),
+      verify(false),
+      expected_size(-1) {
+    ensure_curl_initialized();
+    for (size_t i = 0; i < networks.size(); i++) {
+        pools.push_back(std::unique_ptr<ConnectionPool>(new ConnectionPool()));
+    }
+    reset_progress();
+}
+
+// Out of line so ConnectionPool is complete where the pools are destroyed
+DownloadEngine::~DownloadEngine() {}
+
+void DownloadEngine::bind_handle(CURL* curl, size_t lane, ConnectionPool* pool) const {
+    if (lane >= networks.size()) return;
+    if (!pool) pool = pools[lane].get();
+    curl_easy_setopt(curl, CURLOPT_SHARE, pool->share);
+    if (pool->pins) curl_easy_setopt(curl, CURLOPT_RESOLVE, pool->pins);
+    std::string binding = interface_binding(networks[lane].interface);
+    if (!binding.empty()) curl_easy_setopt(curl, CURLOPT_INTERFACE, binding.c_str());
+}
+
+void DownloadEngine::reset_progress() {
+    for (size_t i = 0; i < networks.size(); i++) {
+        lanes[i].bytes = 0;
+        lanes[i].connections = 0;
+        lanes[i].rate = 0;
+    }
+    downloaded = 0;
+    total = -1;
+    rate = 0;
+    verified = 0;
+}
+
+DownloadProgress DownloadEngine::progress() const {
+    DownloadProgress p;
+    p.running = running;
+    p.downloaded = downloaded.load(std::memory_order_relaxed);
+    p.total = total.load(std::memory_order_relaxed);
+    p.rate = rate.load(std::memory_order_relaxed);
+    p.eta = p.total >= 0 && p.rate > 0 ? (p.total - p.downloaded) / p.rate : -1;
+    p.verified = verified.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < networks.size(); i++) {
+        InterfaceProgress lane = {
+            networks[i].interface,
+            lanes[i].bytes.load(std::memory_order_relaxed),
+            lanes[i].connections.load(std::memory_order_relaxed),
+            lanes[i].rate.load(std::memory_order_relaxed)
+        };
+        p.interfaces.push_back(lane);
+    }
+    return p;
+}
+
+std::string DownloadEngine::metrics_text() const {
+    DownloadProgress p = progress();
+    std::ostringstream out;
+    out << "# HELP mush_download_running Whether a download is in progress\n"
+        << "# TYPE mush_download_running gauge\n"
+        << "mush_download_running " << (p.running ? 1 : 0) << "\n"
+        << "# HELP mush_downloaded_bytes Bytes of the current download on disk\n"
+        << "# TYPE mush_downloaded_bytes gauge\n"
+        << "mush_downloaded_bytes " << p.downloaded << "\n"
+        << "# HELP mush_download_size_bytes Size of the current download, -1 while unknown\n"
+        << "# TYPE mush_download_size_bytes gauge\n"
+        << "mush_download_size_bytes " << p.total << "\n";
+
+    out << "# HELP mush_interface_rate_bytes_per_second Smoothed receive rate per interface\n"
+        << "# TYPE mush_interface_rate_bytes_per_second gauge\n";
+    for (const auto& lane : p.interfaces) {
+        out << "mush_interface_rate_bytes_per_second{interface=\"" << lane.interface << "\"} "
+            << static_cast<int64_t>(lane.rate) << "\n";
+    }
+    out << "# HELP mush_interface_transfers Range requests in flight per interface\n"
+        << "# TYPE mush_interface_transfers gauge\n";
+    for (const auto& lane : p.interfaces) {
+        out << "mush_interface_transfers{interface=\"" << lane.interface << "\"} "
+            << lane.connections << "\n";
+    }
+    return out.str() + metrics.prometheus_text();
+}
+
+// Called from run()'s wait loop, the only writer of the rates. The overall
+// rate sums the interfaces, which is smoother than completed chunks.
+void DownloadEngine::update_rates(double seconds, std::vector<int64_t>& last_bytes) {
+    if (seconds <= 0) return;
+    double sum = 0;
+    for (size_t i = 0; i < networks.size(); i++) {
+        int64_t bytes = lanes[i].bytes.load(std::memory_order_relaxed);
+        double sample = (bytes - last_bytes[i]) / seconds;
+        last_bytes[i] = bytes;
+        lanes[i].rate = lanes[i].rate + kRateSmoothing * (sample - lanes[i].rate);
+        sum += lanes[i].rate;
+    }
+    rate = sum;
+}
+
+void DownloadEngine::set_log_callback(LogCallback callback) {
+    log_callback = callback;
+}
+
+void DownloadEngine::set_progress_callback(ProgressCallback callback) {
+    progress_callback = callback;
+}
+
+void DownloadEngine::set_chunk_size(int64_t bytes) {
+    chunk_size = bytes;
+}
+
+void DownloadEngine::set_connections(int initial, int maximum) {
+    initial_connections = initial;
+    max_connections = maximum;
+}
+
+void DownloadEngine::set_connection_limit(int maximum) {
+    max_connections = maximum;
+}
+
+void DownloadEngine::set_stall_limit(int seconds, int64_t min_rate) {
+    stall_seconds = seconds;
+    stall_rate = min_rate;
+}
+
+void DownloadEngine::set_reorder_buffer(int64_t bytes) {
+    reorder_buffer = bytes;
+}
+
+void DownloadEngine::set_io_uring(bool enabled) {
+    use_io_uring = enabled;
+}
+
+bool DownloadEngine::set_trace_file(const std::string& path, std::string& error) {
+    return metrics.open_trace(path, error);
+}
+
+void DownloadEngine::set_edge_selection(bool enabled) {
+    edge_selection = enabled;
+}
+
+void DownloadEngine::set_history_file(const std::string& path) {
+    history_path = path;
+}
+
+void DownloadEngine::set_monitor_socket(const std::string& path) {
+    monitor_socket = path;
+}
+
+void DownloadEngine::set_http_mode(HttpMode mode) {
+    http_mode = mode;
+}
+
+void DownloadEngine::set_verification(bool enabled, const std::string& expected) {
+    verify = enabled || !expected.empty();
+    expected_sha256 = expected;
+    for (auto& c : expected_sha256) c = static_cast<char>(tolower(c));
+}
+
+void DownloadEngine::set_expected_size(int64_t bytes) {
+    expected_size = bytes;
+}
+
+void DownloadEngine::stop() {
+    stopping = true;
+}
+
+void DownloadEngine::log(const std::string& text) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    if (log_callback) {
+        log_callback(text);
+    } else {
+        std::cout << text << std::endl;
+    }
+}
+
+// One GET for "bytes=0-0" tells size (Content-Range), range support (206)
+// and validators at the cost of a single byte. It runs on the first
+// interface's pool, so its connection is reused for that interface's first
+// chunk instead of being thrown away. A recheck of an interface that was
+// offline uses a new connection and gives up after a short timeout.
+bool DownloadEngine::probe_remote(const std::string& url, RemoteInfo& remote, size_t lane,
+                                  bool recheck, ConnectionPool* pool) {
+    remote.size = -1;
+    remote.ranges = false;
+    remote.http_version = 0;
+    CURL* curl = curl_easy_init();
+    if (!curl) return false;
+
+    setup_handle(curl, url, http_version, stall_seconds, stall_rate, this);
+    bind_handle(curl, lane, pool);
+    if (recheck) {
+        curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1L);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, kRecheckTimeoutSeconds);
+    }
+    curl_easy_setopt(curl, CURLOPT_RANGE, "0-0");
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &remote);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, probe_body_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, curl);
+    curl_easy_perform(curl);
+
+    long code = 0;
+    char* address = nullptr;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &remote.http_version);
+    curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &address);
+    // Where the kept connection leads, so pinning an edge can tell
+    // whether it is still worth reusing
+    std::string host;
+    int port = 0;
+    if (!pool && lane < pools.size()) pool = pools[lane].get();
+    if (code != 0 && address && *address && pool && url_endpoint(url, host, port)) {
+        std::lock_guard<std::mutex> lock(pool->peers_mutex);
+        pool->peers[host + ":" + std::to_string(port)] = address;
+    }
+    curl_easy_cleanup(curl);
+
+    // 416 is what an empty file answers; its Content-Range carries the size
+    remote.ranges = code == 206 || code == 416;
+    if (!remote.ranges) remote.size = -1;
+    return remote.ranges && remote.size >= 0;
+}
+
+// Probes every URL at once. The first one (in the caller's order) that
+// reports a size, the expected one if known, and honours ranges is the
+// reference; the others join as mirrors only if they agree on the size.
+// Fills mirrors and returns the reference's details in remote; on failure
+// remote describes the first URL. libcurl cannot share one connection
+// cache between threads, so each probe gets a pool of its own and the
+// first interface keeps the reference's.
+bool DownloadEngine::probe_mirrors(const std::vector<std::string>& urls, RemoteInfo& remote) {
+    std::vector<RemoteInfo> results(urls.size());
+    std::unique_ptr<bool[]> usable(new bool[urls.size()]());
+    std::vector<std::unique_ptr<ConnectionPool>> probe_pools;
+    std::vector<std::thread> probes;
+    for (size_t i = 0; i < urls.size(); i++) {
+        probe_pools.push_back(std::unique_ptr<ConnectionPool>(new ConnectionPool()));
+    }
+    for (size_t i = 0; i < urls.size(); i++) {
+        probes.push_back(std::thread([this, &urls, &results, &usable, &probe_pools, i]() {
+            usable[i] = probe_remote(urls[i], results[i], 0, false, probe_pools[i].get());
+        }));
+    }
+    for (auto& probe : probes) {
+        probe.join();
+    }
+
+    size_t reference = 0;
+    while (reference < urls.size()
+           && !(usable[reference] && (expected_size < 0 || results[reference].size == expected_size))) {
+        reference++;
+    }
+    if (reference == urls.size()) {
+        if (!pools.empty()) pools[0] = std::move(probe_pools[0]);
+        remote = results[0];
+        return false;
+    }
+    if (!pools.empty()) pools[0] = std::move(probe_pools[reference]);
+    remote = results[reference];
+
+    for (size_t i = 0; i < urls.size(); i++) {
+        std::string host = url_host(urls[i]);
+        if (i != reference && !usable[i]) {
+            log("Skipping mirror " + host + ": "
+                + (results[i].ranges ? "no file size" : "unreachable or no range support"));
+            continue;
+        }
+        if (results[i].size != remote.size) {
+            log("Skipping mirror " + host + ": size " + std::to_string(results[i].size)
+                + " differs from " + std::to_string(remote.size));
+            continue;
+        }
+        mirrors.push_back({urls[i], host, if_range_value(results[i])});
+    }
+    if (urls.size() > 1) {
+        std::string names;
+        for (const auto& mirror : mirrors) {
+            names += (names.empty() ? "" : ", ") + mirror.host;
+        }
+        log("Using " + std::to_string(mirrors.size()) + " of " + std::to_string(urls.size())
+            + " mirrors: " + names);
+    }
+    return true;
+}
+
+bool DownloadEngine::download_single(const std::string& url, OutputFile& file, Sha256* hash) {
+    CURL* curl = curl_easy_init();
+    if (!curl) return false;
+
+    RangeWriter writer = {curl, &file, 0, -1, true, true, false, nullptr, false, 0, hash, nullptr,
+                          RingStream()};
+    setup_handle(curl, url, http_version, stall_seconds, stall_rate, this);
+    bind_handle(curl, 0);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &writer);
+    CURLcode res = curl_easy_perform(curl);
+    curl_easy_cleanup(curl);
+
+    if (res != CURLE_OK) {
+        log(std::string("Single connection download failed: ") + curl_easy_strerror(res));
+        return false;
+    }
+    return !writer.failed;
+}
+
+void DownloadEngine::run_interface(OutputFile& file, size_t lane, ChunkScheduler& scheduler,
+                                   StreamVerifier* verifier) {
+    const NetworkInterface& net = networks[lane];
+    CURLM* multi = curl_multi_init();
+    if (!multi) return;
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    const char* unit = multiplexed ? " stream(s)" : " connection(s)";
+
+    std::string binding = interface_binding(net.interface);
+    if (binding.empty()) {
+        log("Warning: Could not get IP for " + net.interface + ", downloading without binding...");
+    }
+    // Losing the address counts as losing the link only if there was one
+    bool needs_address = !interface_ipv4(net.interface).empty();
+
+    // Points every mirror's host at the edge this interface's own DNS and a
+    // connection race chose; hosts it cannot resolve itself keep the system
+    // resolver. libcurl reuses connections by host name, so the pool only
+    // starts over when one of its connections (the probe's, on the first
+    // interface) leads to another address than the edge; otherwise the
+    // probe's connection, TLS session and DNS entries are kept.
+    auto pin_edges = [&]() {
+        if (!edge_selection) return;
+        curl_slist* pins = nullptr;
+        bool moved = false;
+        for (const auto& mirror : mirrors) {
+            std::string host;
+            int port = 0;
+            if (!url_endpoint(mirror.url, host, port)) continue;
+            Edge edge;
+            std::string error;
+            if (!EdgeResolver::instance().pick(net.interface, host, port, edge, error)) {
+                log("Interface " + net.interface + " resolves " + host + " through the system: " + error);
+                continue;
+            }
+            std::string address = edge.address.find(':') == std::string::npos ? edge.address
+                                                                               : "[" + edge.address + "]";
+            pins = curl_slist_append(pins, (host + ":" + std::to_string(port) + ":" + address).c_str());
+            {
+                ConnectionPool& pool = *pools[lane];
+                std::lock_guard<std::mutex> lock(pool.peers_mutex);
+                auto peer = pool.peers.find(host + ":" + std::to_string(port));
+                if (peer != pool.peers.end() && peer->second != edge.address) moved = true;
+            }
+            std::ostringstream msg;
+            msg << "Interface " << net.interface << " reaches " << host << " at " << edge.address
+                << " (handshake " << std::round(edge.rtt * 10000) / 10 << " ms)";
+            log(msg.str());
+        }
+        if (!pins) return;
+        if (moved) pools[lane].reset(new ConnectionPool());
+        curl_slist_free_all(pools[lane]->pins);
+        pools[lane]->pins = pins;
+    };
+
+    // Each mirror is validated against its own ETag or date
+    std::vector<MirrorLink> links(mirrors.size(), MirrorLink{0, 0, 0, 0, 0, false, false, nullptr});
+    for (size_t m = 0; m < mirrors.size(); m++) {
+        if (!mirrors[m].if_range.empty()) {
+            links[m].headers = curl_slist_append(nullptr, ("If-Range: " + mirrors[m].if_range).c_str());
+        }
+    }
+    size_t usable_mirrors = mirrors.size();
+
+    // Every handle on this interface shares its pool, so finished
+    // connections are kept alive and reused for the next chunk; over
+    // HTTP/2 and HTTP/3 the transfers are streams on one connection
+    // A stream's window also caps the connections (see run())
+    auto connection_limit = [this]() {
+        int maximum = max_connections;
+        return stream_connections > 0 ? std::min(maximum, stream_connections) : maximum;
+    };
+    int limit = connection_limit();
+    int initial = warm_connections[lane] > 0 ? std::min(warm_connections[lane], limit) : initial_connections;
+    ConnectionTuner tuner(initial, limit);
+    std::vector<std::unique_ptr<Transfer>> transfers;
+    // Declared after the transfers so it drains before their streams go
+    std::unique_ptr<WriteRing> ring;
+    if (use_io_uring && !file.streaming()) {
+        ring.reset(new WriteRing(file, kRingBuffers, kRingBufferSize));
+        if (!ring->available()) {
+            log("Interface " + net.interface + " writes chunks with pwrite: " + ring->failure());
+            ring.reset();
+        }
+    }
+    // Staged bytes must be on disk before a range is marked complete,
+    // verified or journaled. A finished transfer waits only for its own
+    // writes, checked with settled() every round; cancelled ones are
+    // settled at once, waiting for the ring.
+    auto settled = [&](Transfer& t) -> bool {
+        if (!ring) return true;
+        ring->flush(t.writer.stream);
+        if (!ring->settled(t.writer.stream)) return false;
+        if (t.writer.stream.failed) {
+            t.writer.failed = true;
+            t.writer.offset = std::min(t.writer.offset, t.writer.stream.failed_at);
+        }
+        return true;
+    };
+    auto settle = [&](Transfer& t) {
+        if (!settled(t)) {
+            ring->drain();
+            settled(t);
+        }
+    };
+    // One timing record per range request, whatever became of it
+    auto trace = [&](Transfer& t, const char* result, const std::string& error) -> ChunkTiming {
+        curl_off_t lookup = 0, connect = 0, handshake = 0, request = 0, first_byte = 0, total = 0;
+        curl_easy_getinfo(t.curl, CURLINFO_NAMELOOKUP_TIME_T, &lookup);
+        curl_easy_getinfo(t.curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(t.curl, CURLINFO_APPCONNECT_TIME_T, &handshake);
+        curl_easy_getinfo(t.curl, CURLINFO_PRETRANSFER_TIME_T, &request);
+        curl_easy_getinfo(t.curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+        curl_easy_getinfo(t.curl, CURLINFO_TOTAL_TIME_T, &total);
+        long new_connections = 0, version = 0;
+        curl_easy_getinfo(t.curl, CURLINFO_NUM_CONNECTS, &new_connections);
+        curl_easy_getinfo(t.curl, CURLINFO_HTTP_VERSION, &version);
+        // The times are cumulative microseconds from the start of the request
+        ChunkTiming timing;
+        timing.interface = net.interface;
+        timing.mirror = mirrors[t.mirror].host;
+        timing.range = t.chunk;
+        timing.bytes = t.writer.offset - t.chunk.start;
+        timing.attempt = 0;
+        timing.reused = new_connections == 0;
+        timing.protocol = http_version_name(version);
+        timing.result = result;
+        timing.error = error;
+        timing.dns = lookup / 1e6;
+        timing.connect = std::max<curl_off_t>(connect - lookup, 0) / 1e6;
+        timing.tls = handshake > 0 ? std::max<curl_off_t>(handshake - connect, 0) / 1e6 : 0;
+        timing.ttfb = first_byte > 0 ? std::max<curl_off_t>(first_byte - request, 0) / 1e6 : 0;
+        timing.transfer = first_byte > 0 ? std::max<curl_off_t>(total - first_byte, 0) / 1e6 : 0;
+        timing.total = total / 1e6;
+        metrics.record(timing);
+        return timing;
+    };
+    auto started = std::chrono::steady_clock::now();
+    auto last_link_check = started;
+    auto last_round = started;
+    LaneHistory& history = lane_history[lane];
+    // Counters keep growing when a verification round restarts the workers
+    int64_t carried = lanes[lane].bytes.load(std::memory_order_relaxed);
+    int64_t bytes = 0;
+    int chunks = 0;
+    long connections = 0;
+    int active = 0;
+    int settling = 0;   // finished transfers waiting for their writes
+    bool draining = false;
+    bool retired = false;
+    std::string offline = link_usable(net.interface, needs_address) ? "" : "is down";
+    // An interface that fails again before finishing a chunk keeps its
+    // earlier outage time, so one that never works is left out eventually
+    auto offline_since = started;
+    int chunks_at_return = -1;
+    bool busy = false;
+    auto set_busy = [&](bool now) {
+        if (now != busy) busy_lanes += now ? 1 : -1;
+        busy = now;
+    };
+
+    // Books a transfer whose bytes are all on disk: marks what arrived
+    // complete and deals with the rest
+    auto finish = [&](Transfer& t) {
+        CURLcode res = t.result;
+        MirrorLink& link = links[t.mirror];
+
+        long connects = 0;
+        curl_easy_getinfo(t.curl, CURLINFO_NUM_CONNECTS, &connects);
+        connections += connects;
+
+        int64_t written = t.writer.offset - t.chunk.start;
+        if (written > 0) {
+            scheduler.complete({t.chunk.start, t.writer.offset - 1});
+            if (verifier) verifier->add({t.chunk.start, t.writer.offset - 1}, t.writer.crc, lane);
+            link.bytes += written;
+        }
+        if (!t.writer.failed && t.writer.offset == t.chunk.end + 1) {
+            chunks++;
+            link.chunks++;
+            link.failures = 0;
+            curl_off_t micros = 0;
+            curl_easy_getinfo(t.curl, CURLINFO_TOTAL_TIME_T, &micros);
+            if (micros > 0) {
+                double sample = written * 1e6 / micros;
+                link.rate = link.rate > 0 ? link.rate + kRateSmoothing * (sample - link.rate) : sample;
+            }
+            ChunkTiming timing = trace(t, "ok", "");
+            // A fresh connection's handshake is the best RTT sample there is
+            double& rtt = history.rtt[t.mirror];
+            if (!timing.reused && timing.connect > 0) {
+                rtt = rtt > 0 ? std::min(rtt, timing.connect) : timing.connect;
+            }
+            size_t slow = usable_mirrors > 1 ? slow_mirror(links) : links.size();
+            if (slow != links.size()) {
+                links[slow].dropped = true;
+                links[slow].slow = true;
+                usable_mirrors--;
+                log("Interface " + net.interface + " stops using slow mirror " + mirrors[slow].host
+                    + " (" + std::to_string(static_cast<int64_t>(links[slow].rate / 1024))
+                    + " KB/s per transfer)");
+            }
+            return;
+        }
+
+        long code = 0;
+        curl_easy_getinfo(t.curl, CURLINFO_RESPONSE_CODE, &code);
+        std::string error;
+        if (code == 429 || code == 503) {
+            error = "HTTP " + std::to_string(code);
+        } else if (t.writer.failed && res == CURLE_WRITE_ERROR) {
+            error = "server ignored the range request or the write failed";
+        } else if (res == CURLE_OPERATION_TIMEDOUT && stall_seconds > 0) {
+            error = "stalled below " + std::to_string(stall_rate) + " bytes/s for "
+                + std::to_string(stall_seconds) + " s";
+        } else {
+            error = curl_easy_strerror(res);
+        }
+        trace(t, stopped() ? "cancelled" : "failed", error);
+
+        // Keep what arrived and hand the rest to the other interfaces first
+        scheduler.requeue({t.writer.offset, t.chunk.end}, lane);
+        if (stopped()) return;
+
+        if (code == 429 || code == 503) {
+            tuner.throttled();
+            log("Interface " + net.interface + " throttled by server (HTTP "
+                + std::to_string(code) + "), limiting to "
+                + std::to_string(tuner.target()) + unit);
+            return;
+        }
+
+        std::string source = mirrors.size() > 1 ? " from " + mirrors[t.mirror].host : "";
+        log("Interface " + net.interface + " chunk failed" + source + ": " + error);
+        if (++link.failures < kMaxConsecutiveFailures || link.dropped) return;
+        if (usable_mirrors > 1) {
+            link.dropped = true;
+            usable_mirrors--;
+            log("Interface " + net.interface + " stops using mirror " + mirrors[t.mirror].host);
+        } else if (t.writer.failed) {
+            // Not the link: re-probing would not help
+            if (!retired) {
+                log("Interface " + net.interface + " giving up; other interfaces will take its chunks");
+                retired = true;
+                draining = true;
+            }
+        } else if (offline.empty()) {
+            offline = "keeps failing";
+        }
+    };
+
+    // Books transfers that finished but still had writes in flight
+    auto settle_finished = [&]() {
+        if (settling == 0) return;
+        ring->drain();
+        for (auto& t : transfers) {
+            if (t->settling) {
+                settled(*t);
+                t->settling = false;
+                finish(*t);
+            }
+        }
+        settling = 0;
+    };
+
+    // Cancels every transfer, keeps what reached the disk and queues the
+    // rest for the other interfaces, then waits for the link to come back
+    auto go_offline = [&]() -> bool {
+        settle_finished();
+        int moved = 0;
+        for (auto& t : transfers) {
+            if (t->active) {
+                curl_multi_remove_handle(multi, t->curl);
+                settle(*t);
+                trace(*t, "cancelled", "interface " + offline);
+                scheduler.complete({t->chunk.start, t->writer.offset - 1});
+                if (verifier) verifier->add({t->chunk.start, t->writer.offset - 1}, t->writer.crc, lane);
+                links[t->mirror].bytes += t->writer.offset - t->chunk.start;
+                links[t->mirror].active--;
+                scheduler.requeue({t->writer.offset, t->chunk.end}, lane);
+                moved++;
+            }
+            curl_easy_cleanup(t->curl);
+        }
+        transfers.clear();
+        active = 0;
+        lanes[lane].connections.store(0, std::memory_order_relaxed);
+        // Connections from before the outage may be dead without knowing it
+        pools[lane].reset(new ConnectionPool());
+        log("Interface " + net.interface + " " + offline + "; "
+            + (moved > 0 ? "moved " + std::to_string(moved) + " unfinished chunk(s) to other interfaces"
+                         : std::string("leaving the download to other interfaces")));
+
+        size_t probe = 0;
+        while (links[probe].dropped) probe++;
+        if (chunks != chunks_at_return) offline_since = std::chrono::steady_clock::now();
+        set_busy(false);
+        bool back = wait_for_link(lane, mirrors[probe].url, needs_address, scheduler, offline_since);
+        offline.clear();
+        if (!back) return false;
+
+        // Mirrors it gave up on may have failed only because of the link
+        for (auto& link : links) {
+            link.failures = 0;
+            if (link.dropped && !link.slow) {
+                link.dropped = false;
+                usable_mirrors++;
+            }
+        }
+        draining = retired;
+        chunks_at_return = chunks;
+        last_link_check = std::chrono::steady_clock::now();
+        last_round = last_link_check;
+        log("Interface " + net.interface + " is back; taking chunks again");
+        pin_edges();
+        return true;
+    };
+
+    if (offline.empty()) pin_edges();
+    while (!stopped()) {
+        if (!offline.empty() && !go_offline()) break;
+
+        while (!draining && active < tuner.target()) {
+            Transfer* slot = nullptr;
+            for (auto& t : transfers) {
+                if (!t->active && !t->settling) {
+                    slot = t.get();
+                    break;
+                }
+            }
+            if (!slot) {
+                CURL* curl = curl_easy_init();
+                if (!curl) break;
+                setup_handle(curl, mirrors[0].url, http_version, stall_seconds, stall_rate, this);
+                bind_handle(curl, lane);
+                transfers.push_back(std::unique_ptr<Transfer>(new Transfer()));
+                slot = transfers.back().get();
+                slot->curl = curl;
+                slot->active = false;
+                slot->settling = false;
+                curl_easy_setopt(curl, CURLOPT_PRIVATE, slot);
+            }
+
+            ByteRange chunk;
+            if (!scheduler.next(lane, chunk)) {
+                // Streaming: more chunks come into reach as the head arrives
+                if (!scheduler.held_back()) draining = true;
+                break;
+            }
+            size_t m = pick_mirror(links);
+            slot->mirror = m;
+            start_transfer(multi, *slot, file, chunk, mirrors[m].url, links[m].headers,
+                           mirrors[m].if_range.empty(), &bytes, verifier != nullptr, ring.get());
+            links[m].active++;
+            active++;
+        }
+        // Ranges still being written may yet come back to the queue
+        set_busy(active > 0 || settling > 0);
+        if (active == 0 && settling > 0) {
+            // Nothing on the network: only the disk is left to wait for
+            settle_finished();
+            continue;
+        }
+        if (active == 0) {
+            // Chunks still in flight elsewhere come back to the queue if
+            // their interface fails, so stay around until they are done;
+            // chunks held back for a slow reader are still to come
+            bool held = scheduler.held_back();
+            if (retired || (busy_lanes == 0 && !held) || scheduler.finished()) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(held ? 20 : 200));
+            last_round = std::chrono::steady_clock::now();
+            draining = false;
+            continue;
+        }
+
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+
+        CURLMsg* msg;
+        int queued = 0;
+        while ((msg = curl_multi_info_read(multi, &queued)) != nullptr) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            Transfer* t = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &t);
+            curl_multi_remove_handle(multi, t->curl);
+            t->active = false;
+            active--;
+            links[t->mirror].active--;
+            t->result = msg->data.result;
+            t->settling = true;
+            settling++;
+            if (ring) ring->flush(t->writer.stream);
+        }
+
+        // Everything staged by this round's callbacks goes out in one call
+        if (ring) ring->submit();
+        for (auto& t : transfers) {
+            if (t->settling && settled(*t)) {
+                t->settling = false;
+                settling--;
+                finish(*t);
+            }
+        }
+
+        LaneCounters& counters = lanes[lane];
+        counters.bytes.store(carried + bytes, std::memory_order_relaxed);
+        counters.connections.store(active, std::memory_order_relaxed);
+
+        if (limit != connection_limit()) {
+            limit = connection_limit();
+            tuner.set_maximum(limit);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        history.busy_seconds += std::chrono::duration<double>(now - last_round).count();
+        last_round = now;
+        double elapsed = std::chrono::duration<double>(now - started).count();
+        if (!draining && tuner.sample(elapsed, bytes)) {
+            log("Interface " + net.interface + " now using " + std::to_string(tuner.target())
+                + unit);
+        }
+
+        // A vanished link shows up here within a second, long before the
+        // stall timeout would notice it
+        if (now - last_link_check >= std::chrono::milliseconds(kLinkCheckMilliseconds)) {
+            last_link_check = now;
+            if (offline.empty() && !link_usable(net.interface, needs_address)) {
+                offline = "lost its link";
+            }
+        }
+
+        // Completed writes wake the poll too, so settling transfers are
+        // booked as soon as their data is on disk
+        struct curl_waitfd ring_wait = {ring ? ring->descriptor() : -1, CURL_WAIT_POLLIN, 0};
+        if (active > 0 && offline.empty()) {
+            curl_multi_poll(multi, settling > 0 ? &ring_wait : nullptr, settling > 0 ? 1 : 0, 100, nullptr);
+        }
+    }
+
+    settle_finished();
+
+    for (auto& t : transfers) {
+        if (t->active) {
+            // Stopped mid-chunk: keep the prefix that reached the disk
+            curl_multi_remove_handle(multi, t->curl);
+            settle(*t);
+            trace(*t, "cancelled", "stopped");
+            scheduler.complete({t->chunk.start, t->writer.offset - 1});
+            if (verifier) verifier->add({t->chunk.start, t->writer.offset - 1}, t->writer.crc, lane);
+            scheduler.requeue({t->writer.offset, t->chunk.end});
+        }
+        curl_easy_cleanup(t->curl);
+    }
+    set_busy(false);
+    curl_multi_cleanup(multi);
+    for (auto& link : links) {
+        curl_slist_free_all(link.headers);
+    }
+    lanes[lane].bytes.store(carried + bytes, std::memory_order_relaxed);
+    lanes[lane].connections.store(0, std::memory_order_relaxed);
+    for (size_t m = 0; m < mirrors.size(); m++) {
+        history.bytes[m] += links[m].bytes;
+    }
+    history.connections = tuner.target();
+
+    std::ostringstream msg;
+    msg << "Interface " << net.interface << " finished " << chunks << " chunk(s), "
+        << bytes << " bytes over " << connections << " new connection(s)";
+    if (mirrors.size() > 1) {
+        for (size_t m = 0; m < mirrors.size(); m++) {
+            msg << (m == 0 ? "; " : ", ") << mirrors[m].host << ": " << links[m].bytes;
+        }
+    }
+    log(msg.str());
+}
+
+// Keeps an offline interface out of the download and re-probes it, first
+// its link and then a one-byte range request over it, with growing pauses.
+// True once it answers again; false when the download no longer needs it
+// or it has been out since `since` for too long.
+bool DownloadEngine::wait_for_link(size_t lane, const std::string& url, bool needs_address,
+                                   const ChunkScheduler& scheduler,
+                                   std::chrono::steady_clock::time_point since) {
+    const std::string& iface = networks[lane].interface;
+    int pause = kRecheckMinSeconds;
+    while (true) {
+        auto recheck = std::chrono::steady_clock::now() + std::chrono::seconds(pause);
+        while (std::chrono::steady_clock::now() < recheck) {
+            if (stopped() || scheduler.finished()) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+
+        RemoteInfo remote;
+        if (link_usable(iface, needs_address) && probe_remote(url, remote, lane, true)
+            && remote.size == total) {
+            return true;
+        }
+        if (std::chrono::steady_clock::now() - since >= std::chrono::seconds(kMaxOfflineSeconds)) {
+            log("Interface " + iface + " still unreachable after " + std::to_string(kMaxOfflineSeconds)
+                + " s; leaving it out");
+            return false;
+        }
+        pause = std::min(pause * 2, kRecheckMaxSeconds);
+    }
+}
+
+std::vector<double> DownloadEngine::interface_weights() const {
+    std::vector<double> weights;
+    for (const auto& net : networks) {
+        weights.push_back(std::abs(net.score));
+    }
+    return weights;
+}
+
+// Looks up what the history knows about the mirrors' hosts. Interfaces with
+// recent records start at the connection count they settled at; when every
+// interface has one, their goodputs are the initial split, which is
+// returned (empty otherwise).
+std::vector<double> DownloadEngine::warm_start() {
+    warm_connections.assign(networks.size(), 0);
+    lane_history.assign(networks.size(), LaneHistory{0, std::vector<int64_t>(mirrors.size(), 0),
+                                                     std::vector<double>(mirrors.size(), 0), 0});
+    if (history_path.empty()) return std::vector<double>();
+
+    HostHistory history(history_path);
+    std::vector<double> weights(networks.size(), 0);
+    std::vector<double> rtts(networks.size(), 0);
+    for (const auto& mirror : mirrors) {
+        std::map<std::string, HostRecord> records = history.lookup(mirror.host, kRecentHistorySeconds);
+        for (size_t i = 0; i < networks.size(); i++) {
+            auto found = records.find(networks[i].interface);
+            if (found == records.end()) continue;
+            weights[i] += found->second.goodput;
+            warm_connections[i] = std::max(warm_connections[i], found->second.connections);
+            if (found->second.rtt > 0 && (rtts[i] == 0 || found->second.rtt < rtts[i])) rtts[i] = found->second.rtt;
+        }
+    }
+
+    std::ostringstream msg;
+    bool known = true;
+    for (size_t i = 0; i < networks.size(); i++) {
+        if (weights[i] <= 0) {
+            known = false;
+            continue;
+        }
+        msg << (msg.tellp() > 0 ? ", " : "") << networks[i].interface << " "
+            << static_cast<int64_t>(weights[i] / 1024) << " KB/s";
+        if (rtts[i] > 0) msg << " RTT " << std::round(rtts[i] * 10000) / 10 << " ms";
+        msg << " x" << warm_connections[i];
+    }
+    if (msg.tellp() > 0) {
+        log(std::string(known ? "Splitting by history: " : "Starting connections from history: ") + msg.str());
+    }
+    return known ? weights : std::vector<double>();
+}
+
+// Folds what every interface measured in this run into the history, per
+// mirror host; interfaces that hardly took part are left out
+void DownloadEngine::remember_performance() {
+    if (history_path.empty()) return;
+    HostHistory history(history_path);
+    for (size_t m = 0; m < mirrors.size(); m++) {
+        std::map<std::string, HostRecord> samples;
+        for (size_t i = 0; i < networks.size(); i++) {
+            const LaneHistory& lane = lane_history[i];
+            if (lane.bytes[m] < kMinHistoryBytes || lane.busy_seconds < kMinHistorySeconds) continue;
+            samples[networks[i].interface] = HostRecord{lane.bytes[m] / lane.busy_seconds, lane.rtt[m],
+                                                        std::max(1, lane.connections), 0, 0};
+        }
+        if (!samples.empty() && !history.update(mirrors[m].host, samples)) {
+            log("Warning: Could not write " + history.path());
+        }
+    }
+}
+
+void DownloadEngine::select_http_version() {
+    multiplexed = false;
+    switch (http_mode) {
+    case HttpMode::Auto: http_version = CURL_HTTP_VERSION_2TLS; break;
+    case HttpMode::Http1: http_version = CURL_HTTP_VERSION_1_1; break;
+    case HttpMode::Http2: http_version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE; break;
+    case HttpMode::Http3:
+        // Without QUIC support libcurl rejects the option outright
+        if (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP3) {
+            http_version = CURL_HTTP_VERSION_3;
+        } else {
+            log("HTTP/3 is not available in this libcurl build; using HTTP/2 where the server offers it");
+            http_version = CURL_HTTP_VERSION_2TLS;
+        }
+        break;
+    }
+}
+
+void DownloadEngine::prepare_routes() {
+    // Policy routes need CAP_NET_ADMIN; without it the source-address
+    // binding still works on hosts whose main table already covers each link
+    if (geteuid() != 0) return;
+    for (const auto& net : networks) {
+        std::string error;
+        if (!RoutingManager::instance().ensure(net.interface, error)) {
+            log("Warning: no policy route for " + net.interface + ": " + error);
+        }
+    }
+}
+
+bool DownloadEngine::run(const std::string& url, const std::string& output) {
+    return run(std::vector<std::string>(1, url), output);
+}
+
+bool DownloadEngine::run(const std::vector<std::string>& urls, const std::string& output) {
+    stopping = false;
+    mirrors.clear();
+    digest.clear();
+    stream_connections = 0;
+    select_http_version();
+    reset_progress();
+    metrics.new_download();
+    running = true;
+    ClearOnExit clear_running = {running};
+
+    if (urls.empty()) {
+        log("Error: no URL to download");
+        return false;
+    }
+    log(urls.size() > 1 ? "Checking " + std::to_string(urls.size()) + " mirrors..."
+                        : std::string("Getting file size..."));
+    RemoteInfo remote;
+    bool have_size = probe_mirrors(urls, remote);
+    if (stopped()) return false;
+
+    OutputFile file;
+    std::string error;
+    bool streaming = OutputFile::is_stream_path(output);
+    std::string destination = output == "-" ? "stdout" : output;
+    if (expected_size >= 0 && !have_size && remote.size >= 0 && remote.size != expected_size) {
+        log("Error: server reports " + std::to_string(remote.size) + " bytes, expected "
+            + std::to_string(expected_size));
+        return false;
+    }
+    if (!have_size || networks.empty()) {
+        log(remote.ranges ? "Server did not report the file size."
+                          : "Server does not support range requests.");
+        log("Downloading over a single connection...");
+        bool opened = streaming ? file.open_stream(output, error) : file.open(output, -1, error);
+        if (!opened) {
+            log("Error: " + error);
+            return false;
+        }
+        // One sequential stream: hash it on the way, nothing to read back
+        Sha256 hash;
+        bool ok = download_single(urls[0], file, verify ? &hash : nullptr);
+        if (ok && streaming && !stopped()) ok = file.finish_stream();
+        int64_t streamed = file.streamed();
+        file.close();
+        struct stat st;
+        if (ok && (streaming || stat(output.c_str(), &st) == 0)) {
+            int64_t bytes = streaming ? streamed : static_cast<int64_t>(st.st_size);
+            downloaded = bytes;
+            if (verify) verified = bytes;
+            if (progress_callback) progress_callback(bytes, -1);
+        }
+        if (!ok || stopped()) return false;
+        if (verify && !check_digest(hash.hex_digest())) return false;
+        log("Download complete (single connection). " + std::string(streaming ? "Streamed to " : "Saved as ")
+            + destination);
+        return true;
+    }
+
+    int64_t size = remote.size;
+    total = size;
+    log("File size: " + std::to_string(size) + " bytes");
+    multiplexed = remote.http_version >= CURL_HTTP_VERSION_2_0;
+    if (multiplexed) {
+        log(std::string("Server speaks ") + http_version_name(remote.http_version)
+            + "; chunks are multiplexed over one connection per interface");
+    }
+    prepare_routes();
+    std::vector<double> learned_weights = warm_start();
+
+    ChunkJournal journal(output);
+    JournalState state = {mirrors[0].url, size, remote.etag, remote.last_modified, 0, {}};
+    bool journaling = !streaming && (!remote.etag.empty() || !remote.last_modified.empty());
+    if (!journaling && !streaming) {
+        log("Server sent no ETag or Last-Modified; this download cannot be resumed.");
+    }
+
+    JournalState previous;
+    std::vector<std::string> mirror_urls;
+    for (const auto& mirror : mirrors) {
+        mirror_urls.push_back(mirror.url);
+    }
+    std::unique_ptr<ChunkScheduler> scheduler;
+    if (streaming) {
+        if (!file.open_stream(output, error)) {
+            log("Error: " + error);
+            return false;
+        }
+        // Every chunk in flight must fit in the window, or the stream's
+        // head could wait behind chunks that are not allowed to start.
+        // Chunks shrink to share it, then connections are capped.
+        int64_t window = std::max<int64_t>(1, reorder_buffer);
+        int64_t lanes_count = static_cast<int64_t>(networks.size());
+        int64_t per_lane = std::max(1, max_connections.load());
+        state.chunk_size = chunk_size > 0 ? chunk_size : default_chunk_size(size, networks.size());
+        state.chunk_size = std::min(state.chunk_size, window / (lanes_count * per_lane));
+        if (state.chunk_size < kMinStreamChunk) {
+            state.chunk_size = kMinStreamChunk;
+            per_lane = window / (kMinStreamChunk * lanes_count);
+            if (per_lane < 1) {
+                log("Error: streaming over " + std::to_string(lanes_count) + " interface(s) needs a reorder "
+                    "buffer of at least " + std::to_string(kMinStreamChunk * lanes_count) + " bytes");
+                file.close();
+                return false;
+            }
+            log("Limiting each interface to " + std::to_string(per_lane)
+                + (multiplexed ? " stream(s)" : " connection(s)")
+                + " to fit the reorder buffer");
+        }
+        stream_connections = static_cast<int>(per_lane);
+        scheduler.reset(new ChunkScheduler(size, std::vector<ByteRange>(), networks.size(),
+                                           state.chunk_size));
+        scheduler->set_window(window, [&file]() { return file.streamed(); });
+        log("Streaming to " + destination + " in file order, holding up to "
+            + std::to_string(window / (1024 * 1024)) + " MB ahead in memory; chunks of up to "
+            + std::to_string(state.chunk_size) + " bytes");
+    } else if (journaling && journal.load(previous) && validators_match(previous, remote, mirror_urls)
+        && file.reopen(output, size, error)) {
+        state.chunk_size = previous.chunk_size > 0
+            ? previous.chunk_size
+            : default_chunk_size(size, networks.size());
+        scheduler.reset(new ChunkScheduler(size, previous.completed, networks.size(),
+                                           state.chunk_size));
+        log("Resuming: " + std::to_string(scheduler->completed_bytes()) + " of "
+            + std::to_string(size) + " bytes already downloaded");
+    } else {
+        if (!file.open(output, size, error)) {
+            log("Error: " + error);
+            return false;
+        }
+        state.chunk_size = chunk_size > 0 ? chunk_size : default_chunk_size(size, networks.size());
+        scheduler.reset(new ChunkScheduler(size, learned_weights.empty() ? interface_weights() : learned_weights,
+                                           state.chunk_size));
+        log("Splitting into " + std::to_string((size + state.chunk_size - 1) / state.chunk_size)
+            + " chunks of up to " + std::to_string(state.chunk_size) + " bytes");
+    }
+    downloaded = scheduler->completed_bytes();
+
+    // Reads the file while workers write it; reset before the file closes.
+    // A stream cannot be read back, so it is hashed on its way out instead.
+    std::unique_ptr<StreamVerifier> verifier;
+    Sha256 stream_hash;
+    if (verify && streaming) {
+        file.set_stream_callback([&stream_hash](const char* data, size_t len) {
+            stream_hash.update(data, len);
+        });
+    } else if (verify) {
+        verifier.reset(new StreamVerifier(file, size));
+        for (const auto& range : scheduler->completed_ranges()) {
+            verifier->add_existing(range);
+        }
+    }
+
+    MonitorClient monitor;
+    if (!monitor_socket.empty()) {
+        ChunkScheduler* live_scheduler = scheduler.get();
+        std::vector<double> live_weights = learned_weights.empty() ? interface_weights() : learned_weights;
+        // Learned weights follow the live score relative to the snapshot
+        std::vector<double> scales(networks.size(), 1.0);
+        for (size_t i = 0; i < networks.size() && !learned_weights.empty(); i++) {
+            if (networks[i].score != 0) scales[i] = learned_weights[i] / std::abs(networks[i].score);
+        }
+        bool subscribed = monitor.start(monitor_socket, [this, live_scheduler, live_weights, scales](
+                const std::vector<LiveSample>& samples) mutable {
+            for (const auto& sample : samples) {
+                for (size_t i = 0; i < networks.size(); i++) {
+                    if (networks[i].interface == sample.interface) live_weights[i] = sample.score * scales[i];
+                }
+            }
+            live_scheduler->set_weights(live_weights);
+        });
+        if (subscribed) log("Using live interface stats from " + monitor_socket);
+    }
+
+    // Data is synced before each journal save so the journal never claims
+    // bytes that a crash could still lose
+    auto save_journal = [&]() {
+        if (!journaling) return;
+        file.sync();
+        state.completed = scheduler->completed_ranges();
+        if (!journal.save(state)) log("Warning: Could not write " + journal.path());
+    };
+
+    auto last_save = std::chrono::steady_clock::now();
+    auto last_tick = last_save;
+    std::vector<int64_t> last_bytes(networks.size(), 0);
+    auto tick = [&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        auto now = std::chrono::steady_clock::now();
+        downloaded = scheduler->completed_bytes();
+        if (verifier) verified = verifier->verified();
+        if (verify && streaming) verified = file.streamed();
+        if (streaming && file.stream_failed() && !stopped()) {
+            log("Error: the reader of " + destination + " went away; stopping");
+            stop();
+        }
+        update_rates(std::chrono::duration<double>(now - last_tick).count(), last_bytes);
+        last_tick = now;
+        if (progress_callback) progress_callback(downloaded, size);
+        if (now - last_save >= std::chrono::seconds(kJournalIntervalSeconds)) {
+            save_journal();
+            last_save = now;
+        }
+    };
+
+    // Bad chunks go back to the queue for another interface than the one
+    // that fetched them; a range that keeps failing is left missing
+    std::map<int64_t, int> mismatch_counts;
+    auto refetch_mismatches = [&]() {
+        bool requeued = false;
+        for (const auto& bad : verifier->take_mismatches()) {
+            scheduler->discard(bad.range);
+            std::string where = "bytes " + std::to_string(bad.range.start) + "-"
+                + std::to_string(bad.range.end);
+            if (bad.lane < networks.size()) where += " from " + networks[bad.lane].interface;
+            if (++mismatch_counts[bad.range.start] > kMaxChunkMismatches) {
+                log("Verification of " + where + " keeps failing; giving up on them");
+                continue;
+            }
+            log("Checksum mismatch in " + where + "; fetching them again");
+            scheduler->requeue(bad.range, bad.lane);
+            requeued = true;
+        }
+        return requeued;
+    };
+
+    log("Waiting for all downloads to complete...");
+    while (true) {
+        std::atomic<int> workers_left(static_cast<int>(networks.size()));
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < networks.size(); i++) {
+            workers.push_back(std::thread([this, &file, &scheduler, &verifier, &workers_left, i]() {
+                run_interface(file, i, *scheduler, verifier.get());
+                workers_left--;
+            }));
+        }
+        bool requeued = false;
+        while (workers_left > 0) {
+            tick();
+            if (verifier && refetch_mismatches()) requeued = true;
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (!verifier || stopped()) break;
+
+        // Hashing trails the download by a few chunks; once it has caught up,
+        // start the workers again for chunks that failed too late for them
+        if (scheduler->finished() && verifier->busy()) log("Verifying...");
+        while (verifier->busy() && !stopped()) {
+            tick();
+        }
+        if (refetch_mismatches()) requeued = true;
+        if (stopped() || !requeued || scheduler->finished()) break;
+    }
+    monitor.stop();
+    remember_performance();
+    downloaded = scheduler->completed_bytes();
+    if (progress_callback) progress_callback(downloaded, size);
+
+    std::string sha256;
+    if (verifier) {
+        verified = verifier->verified();
+        if (verifier->finished()) sha256 = verifier->sha256();
+        verifier.reset();
+    }
+    if (streaming) {
+        // Chunks are done once they are handed over; the pipe may lag
+        if (scheduler->finished() && !stopped()) file.finish_stream();
+        if (verify) verified = file.streamed();
+        if (verify && file.streamed() == size) sha256 = stream_hash.hex_digest();
+        log("Reorder buffer peaked at " + std::to_string(file.peak_buffered()) + " bytes");
+    }
+
+    if (scheduler->finished() && (!verify || !sha256.empty())) {
+        bool complete = !streaming || file.streamed() == size;
+        file.close();
+        if (!complete) {
+            log("Error: could not write everything to " + destination);
+            return false;
+        }
+        if (!streaming) journal.remove();
+        if (verify && !check_digest(sha256)) return false;
+        log("Download complete. " + std::string(streaming ? "Streamed to " : "Saved as ") + destination
+            + " (" + std::to_string(size) + " bytes)");
+        return true;
+    }
+
+    save_journal();
+    file.close();
+    if (stopped()) {
+        log("Download stopped.");
+    } else {
+        log("Download incomplete: " + std::to_string(scheduler->completed_bytes()) + " of "
+            + std::to_string(size) + " bytes received.");
+    }
+    if (journaling) log("Progress saved to " + journal.path() + "; start the same download again to resume.");
+    return false;
+}
+
+// Records the digest of a finished download and compares it with the
+// expected one, if any
+bool DownloadEngine::check_digest(const std::string& sha256) {
+    digest = sha256;
+    if (!expected_sha256.empty() && sha256 != expected_sha256) {
+        log("Error: SHA-256 mismatch: expected " + expected_sha256 + ", got " + sha256);
+        return false;
+    }
+    log("SHA-256: " + sha256 + (expected_sha256.empty() ? "" : " (matches)"));
+    return true;
+}
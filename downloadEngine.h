@@ -0,0 +1,257 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <cstdint>
+#include <curl/curl.h>
+#include "chunkScheduler.h"
+#include "outputFile.h"
+#include "chunkJournal.h"
+#include "monitorClient.h"
+#include "networkConfig.h"
+#include "transferMetrics.h"
+
+class StreamVerifier;
+class Sha256;
+
+const int kDefaultInitialConnections = 2;
+const int kDefaultMaxConnections = 8;
+
+// A transfer slower than kDefaultStallRate bytes/s for this long is stalled
+const int kDefaultStallSeconds = 20;
+const int64_t kDefaultStallRate = 1024;
+
+// Memory for chunks that arrive ahead of a streamed output's position
+const int64_t kDefaultReorderBuffer = 64 * 1024 * 1024;
+
+// HTTP version to ask servers for. Auto negotiates HTTP/2 over TLS and
+// keeps HTTP/1.1 for plain http; Http2 also speaks it to plain http
+// servers (prior knowledge); Http3 tries QUIC first where libcurl has it.
+enum class HttpMode { Auto, Http1, Http2, Http3 };
+
+// Size and validators of the remote resource, from the initial probe
+struct RemoteInfo {
+    int64_t size;           // -1 when unknown
+    bool ranges;            // server answered the probe with 206
+    long http_version;      // CURL_HTTP_VERSION_* the probe negotiated
+    std::string etag;
+    std::string last_modified;
+};
+
+// Live numbers of one interface during run()
+struct InterfaceProgress {
+    std::string interface;
+    int64_t bytes;      // received in this run
+    int connections;    // transfers in flight
+    double rate;        // bytes/s, smoothed
+};
+
+// Snapshot returned by DownloadEngine::progress()
+struct DownloadProgress {
+    bool running;
+    int64_t downloaded; // on disk, including bytes kept from a resumed run
+    int64_t total;      // -1 while unknown
+    double rate;        // bytes/s, smoothed
+    double eta;         // seconds; -1 while unknown
+    int64_t verified;   // hashed from the start of the file, when verifying
+    std::vector<InterfaceProgress> interfaces;
+};
+
+// In-process multi-interface downloader. Each interface gets its own worker
+// thread driving several concurrent range connections bound to that
+// interface; workers pull chunks from a shared ChunkScheduler and write
+// every byte straight into the output file at its final offset. Progress is
+// journaled next to the output so a stopped or failed download resumes.
+// An interface that loses its link or keeps failing hands its unfinished
+// chunks to the others and is re-probed until it can rejoin.
+class DownloadEngine {
+public:
+    typedef std::function<void(const std::string&)> LogCallback;
+    // Bytes on disk and total size; total is -1 when the server sent none
+    typedef std::function<void(int64_t, int64_t)> ProgressCallback;
+
+    explicit DownloadEngine(const std::vector<NetworkInterface>& networks);
+    ~DownloadEngine();
+
+    // Called from worker threads; the callback must be thread-safe
+    void set_log_callback(LogCallback callback);
+
+    // Called a few times a second from the thread inside run()
+    void set_progress_callback(ProgressCallback callback);
+
+    // Blocks until the download finishes, fails or is stopped. An output of
+    // "-" (stdout), a FIFO or a device is streamed in file order instead of
+    // written at offsets; it cannot be resumed.
+    bool run(const std::string& url, const std::string& output);
+
+    // The same file from several mirrors, most preferred first. Mirrors
+    // that ignore ranges or report another size are skipped; each interface
+    // spreads its chunks over the rest by the throughput it measures to
+    // each and stops using mirrors that are much slower or keep failing.
+    bool run(const std::vector<std::string>& urls, const std::string& output);
+
+    // Chunk size for the next run; 0 picks one from the file size
+    void set_chunk_size(int64_t bytes);
+
+    // Concurrent connections per interface: start at initial, let the tuner
+    // climb up to maximum while throughput keeps rising
+    void set_connections(int initial, int maximum);
+
+    // Change the per-interface connection ceiling of a running download
+    void set_connection_limit(int maximum);
+
+    // A transfer that moves fewer than min_rate bytes/s for seconds is cut
+    // off and the rest of its chunk goes to the other interfaces. 0 seconds
+    // disables the check.
+    void set_stall_limit(int seconds, int64_t min_rate);
+
+    // Bytes a streamed download may hold in memory ahead of its position.
+    // Chunks are only fetched this far ahead, lowest offset first.
+    void set_reorder_buffer(int64_t bytes);
+
+    // Write chunks to disk through io_uring, batched and off the network
+    // path; falls back to pwrite where the kernel lacks it. On by default.
+    void set_io_uring(bool enabled);
+
+    // Append a JSON line per range request (interface, range, bytes,
+    // attempt and DNS/connect/TLS/TTFB/transfer times) to path
+    bool set_trace_file(const std::string& path, std::string& error);
+
+    // Resolve each server through every interface's own DNS servers and
+    // connect each interface to the fastest of the addresses it gets, so a
+    // link whose provider is routed to a closer CDN edge uses it. On by
+    // default; off leaves every interface on the system resolver.
+    void set_edge_selection(bool enabled);
+
+    // JSON store of past goodput, RTT and connection counts per interface
+    // and server. A server seen recently gets its initial split and
+    // connection counts from it instead of from networks.json and a ramp;
+    // every download updates it. Empty disables.
+    void set_history_file(const std::string& path);
+
+    // Unix socket of a running `network --daemon`; live interface scores from
+    // it steer work stealing during the download. Empty disables.
+    void set_monitor_socket(const std::string& path);
+
+    // On HTTP/2 and HTTP/3 every chunk of an interface is a stream on one
+    // shared connection, so the connection limit caps streams instead
+    void set_http_mode(HttpMode mode);
+
+    // Hash the file with SHA-256 while it downloads and re-check every chunk
+    // on disk against the CRC32 of the bytes that arrived; bad chunks are
+    // fetched again over another interface. A non-empty expected_sha256
+    // (hex) fails the download when the final digest differs.
+    void set_verification(bool enabled, const std::string& expected_sha256);
+
+    // Size the file is known to have (from a metalink), -1 when unknown.
+    // URLs that report another size serve a different file and are skipped.
+    void set_expected_size(int64_t bytes);
+
+    // SHA-256 (hex) of the last download run with verification; empty if none
+    const std::string& sha256() const { return digest; }
+
+    // Abort all transfers; safe to call from any thread
+    void stop();
+
+    bool stopped() const { return stopping.load(); }
+
+    // Lock-free read of the live counters; cheap enough to poll every frame
+    DownloadProgress progress() const;
+
+    // Live gauges plus per-interface chunk counters and phase histograms in
+    // the Prometheus text format; safe to call from any thread
+    std::string metrics_text() const;
+
+private:
+    // Written by one thread each, read by anyone through progress()
+    struct LaneCounters {
+        std::atomic<int64_t> bytes;
+        std::atomic<int> connections;
+        std::atomic<double> rate;
+    };
+
+    // What one interface measured in a run, by mirror; written by its
+    // worker, read by run() once the workers are joined
+    struct LaneHistory {
+        double busy_seconds;            // with transfers in flight
+        std::vector<int64_t> bytes;
+        std::vector<double> rtt;        // 0 when no connection was timed
+        int connections;                // the tuner's last target
+    };
+
+    // One usable source of the file
+    struct Mirror {
+        std::string url;
+        std::string host;       // for log lines
+        std::string if_range;   // this mirror's own validator
+    };
+
+    // Keep-alive connections, TLS sessions and DNS of one interface,
+    // shared by the probe and every transfer on it
+    struct ConnectionPool;
+
+    std::vector<NetworkInterface> networks;
+    std::vector<Mirror> mirrors;
+    std::vector<std::unique_ptr<ConnectionPool>> pools;
+    std::unique_ptr<LaneCounters[]> lanes;
+    std::atomic<bool> running;
+    std::atomic<int64_t> downloaded;
+    std::atomic<int64_t> total;
+    std::atomic<double> rate;
+    std::atomic<int64_t> verified;
+    LogCallback log_callback;
+    ProgressCallback progress_callback;
+    std::mutex log_mutex;
+    std::atomic<bool> stopping;
+    int64_t chunk_size;
+    int initial_connections;
+    std::atomic<int> max_connections;
+    int stream_connections; // per-interface cap while streaming, 0 for none
+    int stall_seconds;
+    int64_t stall_rate;
+    std::atomic<int> busy_lanes;        // interfaces with chunks in flight
+    bool use_io_uring;
+    int64_t reorder_buffer;
+    std::string monitor_socket;
+    std::string history_path;
+    bool edge_selection;
+    std::vector<int> warm_connections;  // per lane from history, 0 when none
+    std::vector<LaneHistory> lane_history;
+    HttpMode http_mode;
+    long http_version;      // CURL_HTTP_VERSION_* for http_mode, set by run()
+    bool multiplexed;       // the probe negotiated HTTP/2 or newer
+    bool verify;
+    std::string expected_sha256;
+    int64_t expected_size;
+    std::string digest;
+    TransferMetrics metrics;
+
+    DownloadEngine(const DownloadEngine&);
+    DownloadEngine& operator=(const DownloadEngine&);
+
+    void log(const std::string& text);
+    // pool stands in for the lane's own one when given
+    void bind_handle(CURL* curl, size_t lane, ConnectionPool* pool = nullptr) const;
+    void reset_progress();
+    void update_rates(double seconds, std::vector<int64_t>& last_bytes);
+    void select_http_version();
+    void prepare_routes();
+    bool check_digest(const std::string& sha256);
+    bool probe_remote(const std::string& url, RemoteInfo& remote, size_t lane = 0,
+                      bool recheck = false, ConnectionPool* pool = nullptr);
+    bool probe_mirrors(const std::vector<std::string>& urls, RemoteInfo& remote);
+    bool download_single(const std::string& url, OutputFile& file, Sha256* hash);
+    void run_interface(OutputFile& file, size_t lane, ChunkScheduler& scheduler,
+                       StreamVerifier* verifier);
+    bool wait_for_link(size_t lane, const std::string& url, bool needs_address,
+                       const ChunkScheduler& scheduler,
+                       std::chrono::steady_clock::time_point since);
+    std::vector<double> interface_weights() const;
+    std::vector<double> warm_start();
+    void remember_performance();
+};
@@ -1,53 +1,82 @@
 #include <gtk-3.0/gtk/gtk.h>
+#include <glib-unix.h>
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <thread>
+#include <memory>
 #include <cstdlib>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <sys/wait.h>
+#include <cstring>
+#include <csignal>
 #include <sstream>
-#include <json/json.h>
-#include <signal.h>
 #include <vector>
-#include <cmath>
+#include <map>
+#include <deque>
+#include <algorithm>
 #include <iomanip>
+#include "downloadQueue.h"
+#include "metalink.h"
+#include "logRing.h"
+
+// The window redraws progress and flushes new log lines at this rate,
+// however fast the engine produces them
+const guint kFrameIntervalMs = 100;
+// Lines kept in the terminal view; older ones scroll out
+const int kMaxTerminalLines = 2000;
+// Log lines buffered between frames before the oldest are dropped
+const size_t kMaxPendingLines = 4096;
+// Sparkline length: one sample per frame, i.e. the last 30 seconds
+const size_t kHistorySamples = 300;
+// A link whose share of received bytes falls below this fraction of its
+// allocation is flagged as underperforming
+const double kUnderperformRatio = 0.75;
 
 // Forward declaration for global access
 class DownloadMonitorGUI;
 DownloadMonitorGUI* g_app = nullptr;
 
-struct NetworkInterface {
-    std::string interface;
-    double latency;
-    int quality;
-    double score;
-    int signal_strength;
-    double speed;
-    std::string ssid;
-    std::string type;
-};
-
 class DownloadMonitorGUI {
 private:
     GtkWidget *window;
     GtkWidget *url_entry;
     GtkWidget *output_entry;
+    GtkWidget *connections_spin;
+    GtkWidget *priority_spin;
+    GtkWidget *parallel_spin;
+    GtkWidget *priority_share_check;
     GtkWidget *start_btn;
     GtkWidget *stop_btn;
     GtkWidget *terminal_view;
     GtkWidget *status_bar;
     GtkWidget *interfaces_grid;
+    GtkWidget *queue_grid;
     GtkTextBuffer *terminal_buffer;
 
-    pid_t script_pid;
-    bool is_running;
-    std::string script_path;
+    // Live columns of one interface row, summed over all running jobs
+    struct InterfaceRow {
+        GtkWidget *rate_label;
+        GtkWidget *bytes_label;
+        GtkWidget *connections_label;
+        GtkWidget *share_label;
+        GtkWidget *graph;
+        std::deque<double> history;
+        int64_t received;
+    };
+
+    std::vector<InterfaceRow> interface_rows;
+    std::vector<double> allocations;
+    // Per running job, the lane byte counts seen in the previous frame
+    std::map<int, std::vector<int64_t>> seen_lane_bytes;
+
+    std::unique_ptr<DownloadQueue> queue;
+    std::map<int, GtkWidget*> job_status;
+    std::map<int, GtkWidget*> job_progress;
+    int queue_rows;
     std::vector<NetworkInterface> networks;
+    LogRing log_ring;
+    std::string status_text;
 
 public:
-    DownloadMonitorGUI() : script_pid(-1), is_running(false) {}
+    DownloadMonitorGUI() : queue_rows(0), log_ring(kMaxPendingLines) {}
 
     void create_window() {
         // Main window
@@ -77,9 +106,12 @@ public:
         gtk_container_add(GTK_CONTAINER(config_frame), config_grid);
 
         // URL
-        gtk_grid_attach(GTK_GRID(config_grid), gtk_label_new("Download URL:"), 0, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(config_grid), gtk_label_new("Download URL(s):"), 0, 0, 1, 1);
         url_entry = gtk_entry_new();
         gtk_entry_set_width_chars(GTK_ENTRY(url_entry), 70);
+        gtk_widget_set_tooltip_text(url_entry,
+            "One URL, several mirror URLs of the same file separated by spaces, "
+            "or the path of a .meta4/.metalink file");
         gtk_grid_attach(GTK_GRID(config_grid), url_entry, 1, 0, 1, 1);
 
         // Output file
@@ -89,8 +121,31 @@ public:
         gtk_entry_set_width_chars(GTK_ENTRY(output_entry), 70);
         gtk_grid_attach(GTK_GRID(config_grid), output_entry, 1, 1, 1, 1);
 
+        // Connection limit per interface (the engine auto-tunes up to it)
+        gtk_grid_attach(GTK_GRID(config_grid), gtk_label_new("Max Connections/Interface:"), 0, 2, 1, 1);
+        connections_spin = gtk_spin_button_new_with_range(1, 32, 1);
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(connections_spin), kDefaultMaxConnections);
+        gtk_widget_set_halign(connections_spin, GTK_ALIGN_START);
+        gtk_grid_attach(GTK_GRID(config_grid), connections_spin, 1, 2, 1, 1);
+
+        // Queue settings; the connection limit above is shared by running jobs
+        gtk_grid_attach(GTK_GRID(config_grid), gtk_label_new("Priority:"), 0, 3, 1, 1);
+        priority_spin = gtk_spin_button_new_with_range(1, 10, 1);
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(priority_spin), 1);
+        gtk_widget_set_halign(priority_spin, GTK_ALIGN_START);
+        gtk_grid_attach(GTK_GRID(config_grid), priority_spin, 1, 3, 1, 1);
+
+        gtk_grid_attach(GTK_GRID(config_grid), gtk_label_new("Parallel Downloads:"), 0, 4, 1, 1);
+        parallel_spin = gtk_spin_button_new_with_range(1, 16, 1);
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(parallel_spin), kDefaultMaxActiveDownloads);
+        gtk_widget_set_halign(parallel_spin, GTK_ALIGN_START);
+        gtk_grid_attach(GTK_GRID(config_grid), parallel_spin, 1, 4, 1, 1);
+
+        priority_share_check = gtk_check_button_new_with_label("Share bandwidth by priority");
+        gtk_grid_attach(GTK_GRID(config_grid), priority_share_check, 1, 5, 1, 1);
+
         // Interfaces frame
-        GtkWidget *ifaces_frame = gtk_frame_new("Network Interfaces (from networks.json)");
+        GtkWidget *ifaces_frame = gtk_frame_new("Network Interfaces");
         gtk_box_pack_start(GTK_BOX(vbox), ifaces_frame, FALSE, FALSE, 5);
 
         GtkWidget *scrolled_ifaces = gtk_scrolled_window_new(NULL, NULL);
@@ -111,15 +166,39 @@ public:
         gtk_box_set_homogeneous(GTK_BOX(btn_box), TRUE);
         gtk_box_pack_start(GTK_BOX(vbox), btn_box, FALSE, FALSE, 5);
 
-        start_btn = gtk_button_new_with_label("▶ Start Download");
+        start_btn = gtk_button_new_with_label("➕ Add to Queue");
         g_signal_connect(start_btn, "clicked", G_CALLBACK(on_start_clicked_static), this);
         gtk_box_pack_start(GTK_BOX(btn_box), start_btn, TRUE, TRUE, 0);
 
-        stop_btn = gtk_button_new_with_label("⏹ Stop");
+        stop_btn = gtk_button_new_with_label("⏹ Stop All");
         gtk_widget_set_sensitive(stop_btn, FALSE);
         g_signal_connect(stop_btn, "clicked", G_CALLBACK(on_stop_clicked_static), this);
         gtk_box_pack_start(GTK_BOX(btn_box), stop_btn, TRUE, TRUE, 0);
 
+        // Queue frame
+        GtkWidget *queue_frame = gtk_frame_new("Download Queue");
+        gtk_box_pack_start(GTK_BOX(vbox), queue_frame, FALSE, FALSE, 5);
+
+        GtkWidget *scrolled_queue = gtk_scrolled_window_new(NULL, NULL);
+        gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled_queue),
+                                       GTK_POLICY_AUTOMATIC,
+                                       GTK_POLICY_AUTOMATIC);
+        gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(scrolled_queue), 100);
+        gtk_container_add(GTK_CONTAINER(queue_frame), scrolled_queue);
+
+        queue_grid = gtk_grid_new();
+        gtk_grid_set_row_spacing(GTK_GRID(queue_grid), 5);
+        gtk_grid_set_column_spacing(GTK_GRID(queue_grid), 10);
+        gtk_container_set_border_width(GTK_CONTAINER(queue_grid), 10);
+        gtk_container_add(GTK_CONTAINER(scrolled_queue), queue_grid);
+
+        gtk_grid_attach(GTK_GRID(queue_grid), gtk_label_new("#"), 0, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(queue_grid), gtk_label_new("Output"), 1, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(queue_grid), gtk_label_new("Priority"), 2, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(queue_grid), gtk_label_new("Status"), 3, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(queue_grid), gtk_label_new("Progress"), 4, 0, 1, 1);
+        queue_rows = 1;
+
         // Terminal frame
         GtkWidget *terminal_frame = gtk_frame_new("📟 Live Terminal Output");
         gtk_box_pack_start(GTK_BOX(vbox), terminal_frame, TRUE, TRUE, 5);
@@ -154,37 +233,15 @@ public:
         display_interfaces();
 
         gtk_widget_show_all(window);
+        g_timeout_add(kFrameIntervalMs, on_frame_static, this);
     }
 
     void load_networks_from_json() {
-        std::ifstream ifs("networks.json");
-        if (!ifs.is_open()) {
-            std::cerr << "Warning: Could not open networks.json" << std::endl;
+        std::string error;
+        if (!load_networks("networks.json", networks, error)) {
+            std::cerr << "Warning: " << error << std::endl;
             return;
         }
-
-        Json::Value root;
-        Json::Reader reader;
-        if (!reader.parse(ifs, root)) {
-            std::cerr << "Warning: Could not parse networks.json" << std::endl;
-            return;
-        }
-
-        if (root.isMember("networks") && root["networks"].isArray()) {
-            for (const auto& network : root["networks"]) {
-                NetworkInterface iface;
-                iface.interface = network["interface"].asString();
-                iface.latency = network["latency"].asDouble();
-                iface.quality = network["quality"].asInt();
-                iface.score = network["score"].asDouble();
-                iface.signal_strength = network["signal_strength"].asInt();
-                iface.speed = network["speed"].asDouble();
-                iface.ssid = network["ssid"].asString();
-                iface.type = network["type"].asString();
-                networks.push_back(iface);
-            }
-        }
-
         std::cout << "Loaded " << networks.size() << " network interface(s) from networks.json" << std::endl;
     }
 
@@ -192,21 +249,22 @@ public:
         // Headers
         gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Interface"), 0, 0, 1, 1);
         gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Type"), 1, 0, 1, 1);
-        gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Speed (MB/s)"), 2, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Measured (KB/s)"), 2, 0, 1, 1);
         gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Latency (ms)"), 3, 0, 1, 1);
         gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Score"), 4, 0, 1, 1);
         gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Allocation %"), 5, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Live Rate"), 6, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Received"), 7, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Connections"), 8, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("Share %"), 9, 0, 1, 1);
+        gtk_grid_attach(GTK_GRID(interfaces_grid), gtk_label_new("History (30 s)"), 10, 0, 1, 1);
 
-        // Calculate total score (using absolute values for better scores)
-        double total_score = 0;
-        for (const auto& net : networks) {
-            total_score += std::abs(net.score);
-        }
+        allocations = allocation_shares(networks);
 
         // Display each interface
         for (size_t i = 0; i < networks.size(); i++) {
             const auto& net = networks[i];
-            double allocation = total_score > 0 ? (std::abs(net.score) / total_score) * 100 : 0;
+            double allocation = allocations[i];
 
             gtk_grid_attach(GTK_GRID(interfaces_grid), 
                 gtk_label_new(net.interface.c_str()), 0, i + 1, 1, 1);
@@ -232,7 +290,108 @@ public:
             alloc_str << std::fixed << std::setprecision(2) << allocation << "%";
             gtk_grid_attach(GTK_GRID(interfaces_grid), 
                 gtk_label_new(alloc_str.str().c_str()), 5, i + 1, 1, 1);
+
+            // Live columns, filled in by refresh()
+            InterfaceRow row;
+            row.rate_label = gtk_label_new("-");
+            row.bytes_label = gtk_label_new("-");
+            row.connections_label = gtk_label_new("-");
+            row.share_label = gtk_label_new("-");
+            row.graph = gtk_drawing_area_new();
+            gtk_widget_set_size_request(row.graph, 150, 24);
+            g_signal_connect(row.graph, "draw", G_CALLBACK(on_graph_draw_static), GINT_TO_POINTER(i));
+            row.received = 0;
+            gtk_grid_attach(GTK_GRID(interfaces_grid), row.rate_label, 6, i + 1, 1, 1);
+            gtk_grid_attach(GTK_GRID(interfaces_grid), row.bytes_label, 7, i + 1, 1, 1);
+            gtk_grid_attach(GTK_GRID(interfaces_grid), row.connections_label, 8, i + 1, 1, 1);
+            gtk_grid_attach(GTK_GRID(interfaces_grid), row.share_label, 9, i + 1, 1, 1);
+            gtk_grid_attach(GTK_GRID(interfaces_grid), row.graph, 10, i + 1, 1, 1);
+            interface_rows.push_back(row);
+        }
+    }
+
+    // Fold this frame's engine counters into the interface rows
+    void refresh_interfaces(const std::vector<std::pair<int, DownloadProgress>>& running) {
+        std::vector<double> rates(interface_rows.size(), 0);
+        std::vector<int> connections(interface_rows.size(), 0);
+        std::map<int, std::vector<int64_t>> seen;
+
+        for (const auto& item : running) {
+            const auto& lanes = item.second.interfaces;
+            std::vector<int64_t>& previous = seen_lane_bytes[item.first];
+            previous.resize(lanes.size(), 0);
+            for (size_t i = 0; i < lanes.size() && i < interface_rows.size(); i++) {
+                interface_rows[i].received += lanes[i].bytes - previous[i];
+                rates[i] += lanes[i].rate;
+                connections[i] += lanes[i].connections;
+                previous[i] = lanes[i].bytes;
+            }
+            seen[item.first] = previous;
+        }
+        // Jobs that ended drop out; their bytes stay counted
+        seen_lane_bytes.swap(seen);
+
+        int64_t received_total = 0;
+        for (const auto& row : interface_rows) {
+            received_total += row.received;
+        }
+
+        for (size_t i = 0; i < interface_rows.size(); i++) {
+            InterfaceRow& row = interface_rows[i];
+            row.history.push_back(rates[i]);
+            if (row.history.size() > kHistorySamples) row.history.pop_front();
+
+            gtk_label_set_text(GTK_LABEL(row.rate_label), (format_bytes(rates[i]) + "/s").c_str());
+            gtk_label_set_text(GTK_LABEL(row.bytes_label), format_bytes(row.received).c_str());
+            gtk_label_set_text(GTK_LABEL(row.connections_label), std::to_string(connections[i]).c_str());
+
+            // Share of everything received, against the planned allocation
+            if (received_total > 0) {
+                double share = 100.0 * row.received / received_total;
+                std::ostringstream text;
+                text << std::fixed << std::setprecision(2) << share << "%";
+                bool lagging = !running.empty() && share < allocations[i] * kUnderperformRatio;
+                std::string markup = lagging
+                    ? "<span foreground='#e05050'>" + text.str() + " ▼</span>"
+                    : text.str();
+                gtk_label_set_markup(GTK_LABEL(row.share_label), markup.c_str());
+            }
+            gtk_widget_queue_draw(row.graph);
+        }
+    }
+
+    void draw_graph(size_t index, GtkWidget *widget, cairo_t *cr) {
+        const std::deque<double>& history = interface_rows[index].history;
+        double width = gtk_widget_get_allocated_width(widget);
+        double height = gtk_widget_get_allocated_height(widget);
+
+        cairo_set_source_rgb(cr, 0.04, 0.04, 0.04);
+        cairo_paint(cr);
+        if (history.size() < 2) return;
+
+        // Scale to the busiest interface so the rows compare at a glance
+        double peak = 0;
+        for (const auto& row : interface_rows) {
+            for (double rate : row.history) {
+                peak = std::max(peak, rate);
+            }
+        }
+        if (peak <= 0) return;
+
+        double step = width / (kHistorySamples - 1);
+        double x = width - step * (history.size() - 1);
+        cairo_set_source_rgb(cr, 0.0, 1.0, 0.0);
+        cairo_set_line_width(cr, 1.0);
+        cairo_move_to(cr, x, height - 1 - history[0] / peak * (height - 2));
+        for (size_t i = 1; i < history.size(); i++) {
+            cairo_line_to(cr, x + step * i, height - 1 - history[i] / peak * (height - 2));
         }
+        cairo_stroke(cr);
+    }
+
+    static gboolean on_graph_draw_static(GtkWidget *widget, cairo_t *cr, gpointer data) {
+        g_app->draw_graph(GPOINTER_TO_INT(data), widget, cr);
+        return FALSE;
     }
 
     void append_terminal(const std::string& text) {
@@ -240,161 +399,156 @@ public:
         gtk_text_buffer_get_end_iter(terminal_buffer, &end);
         gtk_text_buffer_insert(terminal_buffer, &end, text.c_str(), -1);
 
+        // Keep the buffer bounded: drop whole lines from the top
+        int excess = gtk_text_buffer_get_line_count(terminal_buffer) - kMaxTerminalLines;
+        if (excess > 0) {
+            GtkTextIter start, cut;
+            gtk_text_buffer_get_start_iter(terminal_buffer, &start);
+            gtk_text_buffer_get_iter_at_line(terminal_buffer, &cut, excess);
+            gtk_text_buffer_delete(terminal_buffer, &start, &cut);
+        }
+
         GtkTextMark *mark = gtk_text_buffer_get_insert(terminal_buffer);
         gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(terminal_view), mark, 0.0, TRUE, 0.0, 1.0);
     }
 
-    std::string generate_bash_script(const std::string& url, const std::string& output) {
-        std::ostringstream script;
-        script << "#!/bin/bash\n";
-        script << "set -e\n\n";
-        script << "URL='" << url << "'\n";
-        script << "OUTPUT=\"" << output << "\"\n\n";
-
-        script << "TMP_DIR=$(mktemp -d)\n";
-        script << "trap 'rm -rf \"$TMP_DIR\"' EXIT\n\n";
-
-        script << "echo \"Getting file size...\"\n";
-        script << "FILE_SIZE=$(curl --globoff -sI \"${URL}\" | grep -i '^Content-Length:' | tail -1 | awk '{print $2}' | tr -d '\\r\\n')\n";
-        script << "if [ -z \"$FILE_SIZE\" ] || [ \"$FILE_SIZE\" -eq 0 ] 2>/dev/null; then\n";
-        script << "    echo \"Could not get Content-Length, trying HEAD request...\"\n";
-        script << "    FILE_SIZE=$(curl --globoff -sL -D - \"${URL}\" -o /dev/null | grep -i '^Content-Length:' | tail -1 | awk '{print $2}' | tr -d '\\r\\n')\n";
-        script << "fi\n";
-        script << "if [ -z \"$FILE_SIZE\" ] || ! [[ \"$FILE_SIZE\" =~ ^[0-9]+$ ]]; then\n";
-        script << "    echo \"Error: Could not determine file size. Server may not support range requests.\"\n";
-        script << "    echo \"Attempting single connection download...\"\n";
-        script << "    curl --globoff -L \"${URL}\" -o \"$OUTPUT\"\n";
-        script << "    echo \"Download complete (single connection). Saved as $OUTPUT\"\n";
-        script << "    exit 0\n";
-        script << "fi\n";
-        script << "echo \"File size: $FILE_SIZE bytes\"\n\n";
-
-        // Calculate total score
-        double total_score = 0;
-        for (const auto& net : networks) {
-            total_score += std::abs(net.score);
+    static std::string format_bytes(double bytes) {
+        const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+        int unit = 0;
+        while (bytes >= 1024 && unit < 4) {
+            bytes /= 1024;
+            unit++;
         }
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " " << units[unit];
+        return out.str();
+    }
 
-        // Generate download commands for each interface
-        for (size_t i = 0; i < networks.size(); i++) {
-            const auto& net = networks[i];
-            double allocation = std::abs(net.score) / total_score;
-            
-            script << "# Interface " << (i + 1) << ": " << net.interface 
-                   << " (Score: " << net.score << ", Allocation: " 
-                   << std::fixed << std::setprecision(2) << (allocation * 100) << "%)\n";
-            
-            script << "IFACE" << (i + 1) << "=\"" << net.interface << "\"\n";
-            script << "FILE" << (i + 1) << "=\"$TMP_DIR/part" << (i + 1) << "\"\n";
-            
-            if (i == 0) {
-                // First interface
-                script << "CHUNK_SIZE" << (i + 1) << "=$(( $FILE_SIZE * " 
-                       << (int)(allocation * 100) << " / 100 ))\n";
-                script << "START" << (i + 1) << "=0\n";
-                script << "END" << (i + 1) << "=$(( $CHUNK_SIZE" << (i + 1) << " - 1 ))\n";
-            } else if (i < networks.size() - 1) {
-                // Middle interfaces
-                script << "CHUNK_SIZE" << (i + 1) << "=$(( $FILE_SIZE * " 
-                       << (int)(allocation * 100) << " / 100 ))\n";
-                script << "START" << (i + 1) << "=$(( $END" << i << " + 1 ))\n";
-                script << "END" << (i + 1) << "=$(( $START" << (i + 1) 
-                       << " + $CHUNK_SIZE" << (i + 1) << " - 1 ))\n";
-            } else {
-                // Last interface gets the remainder
-                script << "START" << (i + 1) << "=$(( $END" << i << " + 1 ))\n";
-                script << "END" << (i + 1) << "=$(( $FILE_SIZE - 1 ))\n";
+    static std::string format_eta(double seconds) {
+        if (seconds < 0) return "--:--";
+        long total = static_cast<long>(seconds + 0.5);
+        std::ostringstream out;
+        if (total >= 3600) out << total / 3600 << ":" << std::setw(2) << std::setfill('0');
+        out << (total % 3600) / 60 << ":" << std::setw(2) << std::setfill('0') << total % 60;
+        return out.str();
+    }
+
+    // One frame: flush buffered log lines in a single insert and redraw the
+    // progress of running jobs from the engines' counters
+    void refresh() {
+        std::vector<std::string> lines;
+        size_t dropped = log_ring.drain(lines);
+        if (dropped > 0 || !lines.empty()) {
+            std::string text;
+            if (dropped > 0) text += "... " + std::to_string(dropped) + " line(s) skipped ...\n";
+            for (const auto& line : lines) {
+                text += line;
             }
-            
-            script << "echo \"Interface " << net.interface << " downloading bytes $START" 
-                   << (i + 1) << " to $END" << (i + 1) << " ($(( $END" << (i + 1) 
-                   << " - $START" << (i + 1) << " + 1 )) bytes)\"\n\n";
-            
-            // Bring interface up and get IP
-            script << "ip link set $IFACE" << (i + 1) << " up 2>/dev/null || true\n";
-            script << "sleep 1\n";
-            script << "IP" << (i + 1) << "=$(ip addr show $IFACE" << (i + 1) 
-                   << " | grep 'inet ' | head -1 | awk '{print $2}' | cut -d/ -f1)\n";
-            
-            // Add routing table and rules for this interface
-            script << "if [ -n \"$IP" << (i + 1) << "\" ]; then\n";
-            script << "    GATEWAY" << (i + 1) << "=$(ip route | grep \"default.*$IFACE" 
-                   << (i + 1) << "\" | awk '{print $3}')\n";
-            script << "    if [ -n \"$GATEWAY" << (i + 1) << "\" ]; then\n";
-            script << "        TABLE_ID=" << (100 + i) << "\n";
-            script << "        ip route add default via $GATEWAY" << (i + 1) 
-                   << " dev $IFACE" << (i + 1) << " table $TABLE_ID 2>/dev/null || true\n";
-            script << "        ip rule add from $IP" << (i + 1) 
-                   << " table $TABLE_ID 2>/dev/null || true\n";
-            script << "        echo \"Added routing rule for $IFACE" << (i + 1) 
-                   << " via $GATEWAY" << (i + 1) << "\"\n";
-            script << "    fi\n";
-            script << "fi\n\n";
-            
-            script << "if [ -z \"$IP" << (i + 1) << "\" ]; then\n";
-            script << "    echo \"Warning: Could not get IP for $IFACE" << (i + 1) << "\"\n";
-            script << "    echo \"Attempting download without binding...\"\n";
-            script << "    curl --globoff -L -r $START" << (i + 1) << "-$END" << (i + 1) 
-                   << " --max-time 0 --connect-timeout 30"
-                   << " \"${URL}\" -o \"$FILE" << (i + 1) << "\" 2>&1 &\n";
-            script << "else\n";
-            script << "    echo \"Using IP: $IP" << (i + 1) << " for $IFACE" << (i + 1) << "\"\n";
-            script << "    curl --globoff -L --interface $IP" << (i + 1) 
-                   << " -r $START" << (i + 1) << "-$END" << (i + 1) 
-                   << " --max-time 0 --connect-timeout 30"
-                   << " \"${URL}\" -o \"$FILE" << (i + 1) << "\" 2>&1 &\n";
-            script << "fi\n";
-            script << "PID" << (i + 1) << "=$!\n\n";
+            append_terminal(text);
         }
 
-        // Wait for all downloads
-        script << "echo \"Waiting for all downloads to complete...\"\n";
-        for (size_t i = 0; i < networks.size(); i++) {
-            script << "wait $PID" << (i + 1) << "\n";
-            script << "EXITCODE" << (i + 1) << "=$?\n";
-            script << "if [ $EXITCODE" << (i + 1) << " -eq 0 ]; then\n";
-            script << "    echo \"Interface " << (i + 1) << " download complete\"\n";
-            script << "else\n";
-            script << "    echo \"Interface " << (i + 1) << " download failed with code $EXITCODE" << (i + 1) << "\"\n";
-            script << "fi\n";
+        std::vector<std::pair<int, DownloadProgress>> running;
+        if (queue) running = queue->progress();
+        refresh_interfaces(running);
+        if (!queue) return;
+
+        double total_rate = 0;
+        int64_t remaining = 0;
+        bool eta_known = true;
+        for (const auto& item : running) {
+            const DownloadProgress& p = item.second;
+            total_rate += p.rate;
+            if (p.total >= 0) remaining += p.total - p.downloaded;
+            else eta_known = false;
+
+            auto it = job_progress.find(item.first);
+            if (it == job_progress.end()) continue;
+            std::ostringstream text;
+            if (p.total > 0) text << std::fixed << std::setprecision(1) << 100.0 * p.downloaded / p.total << "%  ";
+            text << format_bytes(p.rate) << "/s  ETA " << format_eta(p.eta);
+            gtk_label_set_text(GTK_LABEL(it->second), text.str().c_str());
         }
-        script << "\n";
 
-        // Cleanup routing rules
-        script << "# Cleanup routing rules\n";
-        for (size_t i = 0; i < networks.size(); i++) {
-            script << "if [ -n \"$IP" << (i + 1) << "\" ]; then\n";
-            script << "    TABLE_ID=" << (100 + i) << "\n";
-            script << "    sudo ip rule del from $IP" << (i + 1) << " table $TABLE_ID 2>/dev/null || true\n";
-            script << "    sudo ip route flush table $TABLE_ID 2>/dev/null || true\n";
-            script << "fi\n";
+        std::ostringstream status;
+        if (running.empty()) {
+            status << "Ready";
+        } else {
+            status << running.size() << " running  " << format_bytes(total_rate) << "/s  ETA "
+                   << format_eta(eta_known && total_rate > 0 ? remaining / total_rate : -1);
         }
-        script << "\n";
-
-        // Merge files
-        script << "echo \"Merging files...\"\n";
-        script << "cat";
-        for (size_t i = 0; i < networks.size(); i++) {
-            script << " \"$FILE" << (i + 1) << "\"";
+        if (status.str() != status_text) {
+            status_text = status.str();
+            gtk_label_set_text(GTK_LABEL(status_bar), status_text.c_str());
         }
-        script << " > \"$OUTPUT\"\n";
-        script << "echo \"Download complete. Saved as $OUTPUT\"\n";
-        script << "ls -lh \"$OUTPUT\"\n";
+    }
 
-        return script.str();
+    static gboolean on_frame_static(gpointer data) {
+        static_cast<DownloadMonitorGUI*>(data)->refresh();
+        return TRUE;
     }
 
-    static gboolean update_terminal_idle(gpointer data) {
-        auto* pair = static_cast<std::pair<DownloadMonitorGUI*, std::string*>*>(data);
-        pair->first->append_terminal(*pair->second);
-        delete pair->second;
-        delete pair;
+    // Job state change posted from a queue worker thread
+    struct JobUpdate {
+        DownloadMonitorGUI* app;
+        DownloadJob job;
+    };
+
+    static gboolean update_job_idle(gpointer data) {
+        JobUpdate* update = static_cast<JobUpdate*>(data);
+        update->app->show_job_state(update->job);
+        delete update;
         return FALSE;
     }
 
-    void start_download() {
-        if (is_running) return;
+    void show_job_state(const DownloadJob& job) {
+        auto it = job_status.find(job.id);
+        if (it != job_status.end()) gtk_label_set_text(GTK_LABEL(it->second), job_state_name(job.state));
+        auto progress = job_progress.find(job.id);
+        if (progress != job_progress.end() && job.state == JobState::Done) {
+            gtk_label_set_text(GTK_LABEL(progress->second), "100%");
+        }
+
+        if (job.state == JobState::Done || job.state == JobState::Failed
+            || job.state == JobState::Stopped) {
+            append_terminal("[#" + std::to_string(job.id) + "] " + job.output + ": "
+                            + job_state_name(job.state) + "\n");
+        }
+    }
+
+    void add_job_row(int id, const std::string& output, int priority) {
+        gtk_grid_attach(GTK_GRID(queue_grid),
+            gtk_label_new(std::to_string(id).c_str()), 0, queue_rows, 1, 1);
+        gtk_grid_attach(GTK_GRID(queue_grid), gtk_label_new(output.c_str()), 1, queue_rows, 1, 1);
+        gtk_grid_attach(GTK_GRID(queue_grid),
+            gtk_label_new(std::to_string(priority).c_str()), 2, queue_rows, 1, 1);
+
+        GtkWidget *status = gtk_label_new(job_state_name(JobState::Queued));
+        gtk_grid_attach(GTK_GRID(queue_grid), status, 3, queue_rows, 1, 1);
+        job_status[id] = status;
+
+        GtkWidget *progress = gtk_label_new("");
+        gtk_grid_attach(GTK_GRID(queue_grid), progress, 4, queue_rows, 1, 1);
+        job_progress[id] = progress;
 
+        GtkWidget *cancel_btn = gtk_button_new_with_label("✖");
+        g_signal_connect(cancel_btn, "clicked", G_CALLBACK(on_cancel_clicked_static), GINT_TO_POINTER(id));
+        gtk_grid_attach(GTK_GRID(queue_grid), cancel_btn, 5, queue_rows, 1, 1);
+
+        queue_rows++;
+        gtk_widget_show_all(queue_grid);
+    }
+
+    void create_queue() {
+        queue.reset(new DownloadQueue(networks));
+        queue->set_log_callback([this](int id, const std::string& text) {
+            log_ring.push("[#" + std::to_string(id) + "] " + text + "\n");
+        });
+        queue->set_state_callback([this](const DownloadJob& job) {
+            g_idle_add(update_job_idle, new JobUpdate{this, job});
+        });
+    }
+
+    void start_download() {
         if (networks.empty()) {
             GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(window),
                 GTK_DIALOG_MODAL,
@@ -420,83 +574,60 @@ public:
             return;
         }
 
-        std::string script = generate_bash_script(url, output);
-
-        char temp_template[] = "/tmp/download_XXXXXX.sh";
-        int fd = mkstemps(temp_template, 3);
-        if (fd == -1) {
-            append_terminal("Failed to create temporary script file.\n");
-            return;
-        }
-
-        script_path = temp_template;
-        write(fd, script.c_str(), script.size());
-        close(fd);
-        chmod(script_path.c_str(), 0755);
-
-        append_terminal("Starting download script...\n");
-        gtk_widget_set_sensitive(start_btn, FALSE);
-        gtk_widget_set_sensitive(stop_btn, TRUE);
-        is_running = true;
-
-        std::thread([this]() {
-            int pipefd[2];
-            if (pipe(pipefd) == -1) {
-                g_idle_add([](gpointer data) -> gboolean {
-                    static_cast<DownloadMonitorGUI*>(data)->append_terminal("Failed to create pipe\n");
-                    return FALSE;
-                }, this);
+        if (!queue) create_queue();
+
+        // Settings apply to the whole queue and take effect immediately
+        queue->set_connection_budget(gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(connections_spin)));
+        queue->set_max_active(gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(parallel_spin)));
+        queue->set_policy(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(priority_share_check))
+                          ? SharePolicy::Priority
+                          : SharePolicy::Fair);
+
+        // Mirrors are separated by whitespace; a metalink file lists its own
+        std::vector<std::string> urls;
+        std::istringstream words(url);
+        std::string word;
+        while (words >> word) urls.push_back(word);
+        if (urls.empty()) return;
+        int64_t expected_size = -1;
+        std::string sha256;
+        if (urls.size() == 1 && is_metalink_path(urls[0])) {
+            MetalinkFile metalink;
+            std::string error;
+            if (!load_metalink(urls[0], metalink, error)) {
+                append_terminal("Error: " + error + "\n");
                 return;
             }
+            urls = metalink.urls;
+            expected_size = metalink.size;
+            sha256 = metalink.sha256;
+        }
 
-            script_pid = fork();
-            if (script_pid == 0) {
-                // Child process
-                close(pipefd[0]); // Close read end
-                dup2(pipefd[1], STDOUT_FILENO);
-                dup2(pipefd[1], STDERR_FILENO);
-                close(pipefd[1]);
-                execl(script_path.c_str(), script_path.c_str(), NULL);
-                _exit(1);
-            } else {
-                // Parent process
-                close(pipefd[1]); // Close write end
-
-                // Read output from pipe
-                char buffer[1024];
-                ssize_t count;
-                while ((count = read(pipefd[0], buffer, sizeof(buffer) - 1)) > 0) {
-                    buffer[count] = '\0';
-                    std::string* output = new std::string(buffer);
-                    auto* pair = new std::pair<DownloadMonitorGUI*, std::string*>(this, output);
-                    g_idle_add(update_terminal_idle, pair);
-                }
-                close(pipefd[0]);
-
-                int status;
-                waitpid(script_pid, &status, 0);
-                
-                g_idle_add([](gpointer data) -> gboolean {
-                    DownloadMonitorGUI* app = static_cast<DownloadMonitorGUI*>(data);
-                    gtk_widget_set_sensitive(app->start_btn, TRUE);
-                    gtk_widget_set_sensitive(app->stop_btn, FALSE);
-                    app->is_running = false;
-                    app->append_terminal("\nDownload finished.\n");
-                    return FALSE;
-                }, this);
-            }
-        }).detach();
+        std::string output_str(output);
+        int priority = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(priority_spin));
+        int id = queue->add(urls, output_str, priority, expected_size, sha256);
+        // The queue renames outputs another job already writes to
+        std::string saved_as = queue->output_of(id);
+        add_job_row(id, saved_as, priority);
+        append_terminal("Queued #" + std::to_string(id) + ": " + urls[0]
+                        + (urls.size() > 1 ? " (+" + std::to_string(urls.size() - 1) + " mirrors)" : "")
+                        + (saved_as != output_str ? " as " + saved_as : "") + "\n");
+        gtk_widget_set_sensitive(stop_btn, TRUE);
     }
 
     void stop_download() {
-        if (!is_running) return;
-        if (script_pid > 0) {
-            kill(script_pid, SIGTERM);
-            append_terminal("Download stopped.\n");
-            gtk_widget_set_sensitive(start_btn, TRUE);
-            gtk_widget_set_sensitive(stop_btn, FALSE);
-            is_running = false;
-        }
+        if (!queue) return;
+        // Workers report each job as stopped once its transfers unwind
+        queue->cancel_all();
+        append_terminal("Stopping all downloads...\n");
+    }
+
+    void cancel_job(int id) {
+        if (queue) queue->cancel(id);
+    }
+
+    static void on_cancel_clicked_static(GtkWidget *widget, gpointer data) {
+        g_app->cancel_job(GPOINTER_TO_INT(data));
     }
 
     static void on_start_clicked_static(GtkWidget *widget, gpointer data) {
@@ -508,8 +639,19 @@ public:
     }
 };
 
+// Leave gtk_main normally on Ctrl+C / kill so policy routes get removed
+static gboolean quit_on_signal(gpointer) {
+    gtk_main_quit();
+    return G_SOURCE_REMOVE;
+}
+
 int main(int argc, char* argv[]) {
     gtk_init(&argc, &argv);
+    g_unix_signal_add(SIGINT, quit_on_signal, NULL);
+    g_unix_signal_add(SIGTERM, quit_on_signal, NULL);
+    // A FIFO output whose reader quits fails that job's writes instead of
+    // killing the GUI and every other download
+    signal(SIGPIPE, SIG_IGN);
     g_app = new DownloadMonitorGUI();
     g_app->create_window();
     gtk_main();
@@ -0,0 +1,285 @@
+#include "downloadQueue.h"
+
+#include <algorithm>
+
+namespace {
+
+// "name-N.ext" for the Nth alternative to "name.ext"
+std::string numbered_output(const std::string& output, int n) {
+    size_t slash = output.find_last_of('/');
+    size_t dot = output.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash) || dot == slash + 1
+        || dot == 0) {
+        dot = output.size();
+    }
+    return output.substr(0, dot) + "-" + std::to_string(n) + output.substr(dot);
+}
+
+} // namespace
+
+const char* job_state_name(JobState state) {
+    switch (state) {
+        case JobState::Queued: return "queued";
+        case JobState::Running: return "running";
+        case JobState::Done: return "done";
+        case JobState::Failed: return "failed";
+        case JobState::Stopped: return "stopped";
+    }
+    return "unknown";
+}
+
+DownloadQueue::DownloadQueue(const std::vector<NetworkInterface>& networks)
+    : networks(networks),
+      policy(SharePolicy::Fair),
+      max_active(kDefaultMaxActiveDownloads),
+      budget(kDefaultMaxConnections),
+      next_id(1),
+      shutting_down(false) {}
+
+DownloadQueue::~DownloadQueue() {
+    std::unique_lock<std::mutex> lock(mutex);
+    shutting_down = true;
+    for (auto& job : all_jobs) {
+        if (job.state == JobState::Queued) job.state = JobState::Stopped;
+    }
+    for (auto& w : workers) {
+        w.engine->stop();
+    }
+    // Only this destructor joins from here on, once no worker uses the lock
+    idle.wait(lock, [this]() {
+        for (const auto& w : workers) {
+            if (!w.exited) return false;
+        }
+        return true;
+    });
+    lock.unlock();
+    for (auto& w : workers) {
+        if (w.thread.joinable()) w.thread.join();
+    }
+}
+
+void DownloadQueue::set_log_callback(LogCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    log_callback = callback;
+}
+
+void DownloadQueue::set_state_callback(StateCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    state_callback = callback;
+}
+
+void DownloadQueue::set_max_active(int jobs) {
+    std::unique_lock<std::mutex> lock(mutex);
+    max_active = std::max(1, jobs);
+    dispatch(lock);
+}
+
+void DownloadQueue::set_policy(SharePolicy share_policy) {
+    std::lock_guard<std::mutex> lock(mutex);
+    policy = share_policy;
+    rebalance();
+}
+
+void DownloadQueue::set_connection_budget(int connections) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = std::max(1, connections);
+    rebalance();
+}
+
+int DownloadQueue::add(const std::string& url, const std::string& output, int priority) {
+    return add(std::vector<std::string>(1, url), output, priority);
+}
+
+int DownloadQueue::add(const std::vector<std::string>& urls, const std::string& output, int priority,
+                       int64_t expected_size, const std::string& sha256) {
+    std::unique_lock<std::mutex> lock(mutex);
+    // Two live jobs writing one file would corrupt it and share a journal
+    std::string unique = output;
+    for (int n = 1; output_in_use(unique); ++n) {
+        unique = numbered_output(output, n);
+    }
+    DownloadJob job = {next_id++, urls.empty() ? "" : urls[0],
+                       std::vector<std::string>(urls.empty() ? urls.end() : urls.begin() + 1, urls.end()),
+                       unique, std::max(1, priority), JobState::Queued, expected_size, sha256};
+    all_jobs.push_back(job);
+    notify(job, lock);
+    dispatch(lock);
+    return job.id;
+}
+
+std::string DownloadQueue::output_of(int id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& job : all_jobs) {
+        if (job.id == id) return job.output;
+    }
+    return "";
+}
+
+void DownloadQueue::cancel(int id) {
+    std::unique_lock<std::mutex> lock(mutex);
+    DownloadJob* job = find_job(id);
+    if (!job) return;
+    if (job->state == JobState::Queued) {
+        job->state = JobState::Stopped;
+        DownloadJob copy = *job;
+        notify(copy, lock);
+        idle.notify_all();
+    } else if (job->state == JobState::Running) {
+        for (auto& w : workers) {
+            if (w.id == id && !w.finished) w.engine->stop();
+        }
+    }
+}
+
+void DownloadQueue::cancel_all() {
+    std::vector<int> ids;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& job : all_jobs) {
+            ids.push_back(job.id);
+        }
+    }
+    for (int id : ids) {
+        cancel(id);
+    }
+}
+
+void DownloadQueue::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() {
+        if (running_count() > 0) return false;
+        for (const auto& job : all_jobs) {
+            if (job.state == JobState::Queued) return false;
+        }
+        return true;
+    });
+}
+
+std::vector<DownloadJob> DownloadQueue::jobs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return all_jobs;
+}
+
+std::vector<std::pair<int, DownloadProgress>> DownloadQueue::progress() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::pair<int, DownloadProgress>> running;
+    for (const auto& w : workers) {
+        if (!w.finished) running.push_back(std::make_pair(w.id, w.engine->progress()));
+    }
+    return running;
+}
+
+DownloadJob* DownloadQueue::find_job(int id) {
+    for (auto& job : all_jobs) {
+        if (job.id == id) return &job;
+    }
+    return nullptr;
+}
+
+bool DownloadQueue::output_in_use(const std::string& output) const {
+    for (const auto& job : all_jobs) {
+        if ((job.state == JobState::Queued || job.state == JobState::Running) && job.output == output) return true;
+    }
+    return false;
+}
+
+int DownloadQueue::running_count() const {
+    int count = 0;
+    for (const auto& w : workers) {
+        if (!w.finished) count++;
+    }
+    return count;
+}
+
+int DownloadQueue::share_for(int priority) const {
+    int total = 0;
+    for (const auto& w : workers) {
+        if (!w.finished) total += policy == SharePolicy::Priority ? w.priority : 1;
+    }
+    int weight = policy == SharePolicy::Priority ? priority : 1;
+    if (total <= 0) return budget;
+    // Every job keeps at least one connection per interface
+    return std::max(1, budget * weight / total);
+}
+
+void DownloadQueue::rebalance() {
+    for (auto& w : workers) {
+        if (!w.finished) w.engine->set_connection_limit(share_for(w.priority));
+    }
+}
+
+void DownloadQueue::reap() {
+    if (shutting_down) return;
+    for (auto it = workers.begin(); it != workers.end();) {
+        if (it->exited) {
+            if (it->thread.joinable()) it->thread.join();
+            it = workers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void DownloadQueue::dispatch(std::unique_lock<std::mutex>& lock) {
+    reap();
+    while (!shutting_down && running_count() < max_active) {
+        // Highest priority first, oldest first among equals
+        DownloadJob* best = nullptr;
+        for (auto& job : all_jobs) {
+            if (job.state == JobState::Queued && (!best || job.priority > best->priority)) {
+                best = &job;
+            }
+        }
+        if (!best) break;
+
+        best->state = JobState::Running;
+        workers.push_back(Worker());
+        Worker* worker = &workers.back();
+        worker->id = best->id;
+        worker->priority = best->priority;
+        worker->finished = false;
+        worker->exited = false;
+        worker->engine.reset(new DownloadEngine(networks));
+        worker->engine->set_expected_size(best->expected_size);
+        worker->engine->set_verification(!best->sha256.empty(), best->sha256);
+
+        int share = share_for(worker->priority);
+        worker->engine->set_connections(std::min(kDefaultInitialConnections, share), share);
+        int id = best->id;
+        LogCallback logger = log_callback;
+        worker->engine->set_log_callback([logger, id](const std::string& text) {
+            if (logger) logger(id, text);
+        });
+        rebalance();
+
+        DownloadJob copy = *best;
+        std::vector<std::string> urls(1, copy.url);
+        urls.insert(urls.end(), copy.mirrors.begin(), copy.mirrors.end());
+        worker->thread = std::thread(&DownloadQueue::run_job, this, worker, urls, copy.output);
+        notify(copy, lock);
+    }
+}
+
+void DownloadQueue::run_job(Worker* worker, std::vector<std::string> urls, std::string output) {
+    bool ok = worker->engine->run(urls, output);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    worker->finished = true;
+    DownloadJob* job = find_job(worker->id);
+    job->state = ok ? JobState::Done : worker->engine->stopped() ? JobState::Stopped : JobState::Failed;
+    DownloadJob copy = *job;
+    rebalance();
+    notify(copy, lock);
+    dispatch(lock);
+    worker->exited = true;
+    idle.notify_all();
+}
+
+void DownloadQueue::notify(const DownloadJob& job, std::unique_lock<std::mutex>& lock) {
+    StateCallback callback = state_callback;
+    if (!callback) return;
+    // Callbacks may call back into the queue
+    lock.unlock();
+    callback(job);
+    lock.lock();
+}
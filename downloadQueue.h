@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include "downloadEngine.h"
+
+const int kDefaultMaxActiveDownloads = 3;
+
+enum class JobState { Queued, Running, Done, Failed, Stopped };
+
+const char* job_state_name(JobState state);
+
+struct DownloadJob {
+    int id;
+    std::string url;
+    std::vector<std::string> mirrors;   // further sources of the same file
+    std::string output;
+    int priority;
+    JobState state;
+    int64_t expected_size;              // -1 when not known in advance
+    std::string sha256;                 // checked after the download; empty for none
+};
+
+// How running jobs split each interface's connection budget
+enum class SharePolicy {
+    Fair,       // equal share per running job
+    Priority    // share proportional to job priority
+};
+
+// Runs several downloads at once over the same interfaces. Up to
+// max_active jobs run concurrently, each on its own DownloadEngine; the
+// per-interface connection budget is divided between them by policy and
+// re-divided whenever a job starts or ends. Queued jobs start, highest
+// priority first, as soon as a slot frees up.
+class DownloadQueue {
+public:
+    typedef std::function<void(int, const std::string&)> LogCallback;
+    typedef std::function<void(const DownloadJob&)> StateCallback;
+
+    explicit DownloadQueue(const std::vector<NetworkInterface>& networks);
+    ~DownloadQueue();
+
+    // Both callbacks are invoked from worker threads
+    void set_log_callback(LogCallback callback);
+    void set_state_callback(StateCallback callback);
+
+    void set_max_active(int jobs);
+    void set_policy(SharePolicy policy);
+
+    // Connections per interface shared by all running jobs
+    void set_connection_budget(int connections);
+
+    // Queue a download; returns its job id. Higher priority runs first and,
+    // under SharePolicy::Priority, gets more connections. An output already
+    // taken by a queued or running job gets a "-N" suffix; see output_of().
+    int add(const std::string& url, const std::string& output, int priority = 1);
+
+    // The same with mirrors: urls holds every source, most preferred first.
+    // A known size and SHA-256 (from a metalink) are checked as the CLI does.
+    int add(const std::vector<std::string>& urls, const std::string& output, int priority = 1,
+            int64_t expected_size = -1, const std::string& sha256 = "");
+
+    // File job id writes to, empty for an unknown id
+    std::string output_of(int id) const;
+
+    // Drop a queued job or stop a running one
+    void cancel(int id);
+    void cancel_all();
+
+    // Block until no job is queued or running
+    void wait();
+
+    std::vector<DownloadJob> jobs() const;
+
+    // Live counters of every running job, by job id
+    std::vector<std::pair<int, DownloadProgress>> progress() const;
+
+private:
+    struct Worker {
+        int id;
+        int priority;
+        std::unique_ptr<DownloadEngine> engine;
+        std::thread thread;
+        bool finished;  // no longer counts as running
+        bool exited;    // past its last use of the lock; safe to join
+    };
+
+    std::vector<NetworkInterface> networks;
+    mutable std::mutex mutex;
+    std::condition_variable idle;
+    std::vector<DownloadJob> all_jobs;
+    std::list<Worker> workers;
+    LogCallback log_callback;
+    StateCallback state_callback;
+    SharePolicy policy;
+    int max_active;
+    int budget;
+    int next_id;
+    bool shutting_down;
+
+    DownloadJob* find_job(int id);
+    bool output_in_use(const std::string& output) const;
+    int running_count() const;
+    int share_for(int priority) const;
+    void dispatch(std::unique_lock<std::mutex>& lock);
+    void rebalance();
+    void reap();
+    void run_job(Worker* worker, std::vector<std::string> urls, std::string output);
+    void notify(const DownloadJob& job, std::unique_lock<std::mutex>& lock);
+};
@@ -0,0 +1,431 @@
+#include "edgeResolver.h"
+
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "interfaceInfo.h"
+
+namespace {
+
+// Each nameserver gets this long to answer both queries
+const int kQueryTimeoutMs = 2000;
+const size_t kMaxServers = 3;
+
+// Gap between connection attempts. RFC 8305 suggests 250 ms to save
+// connections, but here every candidate should get a fair start so the
+// fastest edge wins rather than the first one tried.
+const int kAttemptDelayMs = 25;
+const int kRaceTimeoutMs = 3000;
+const size_t kMaxCandidates = 8;
+
+// Cache bounds: very short TTLs would re-race on every chunk
+const uint32_t kMinTtlSeconds = 30;
+const uint32_t kMaxTtlSeconds = 3600;
+
+const uint16_t kTypeA = 1;
+const uint16_t kTypeAAAA = 28;
+const uint8_t kRcodeNameError = 3;
+
+struct Answer {
+    std::string address;
+    uint32_t ttl;
+};
+
+bool numeric_address(const std::string& text, int& family) {
+    unsigned char buffer[sizeof(struct in6_addr)];
+    if (inet_pton(AF_INET, text.c_str(), buffer) == 1) {
+        family = AF_INET;
+        return true;
+    }
+    if (inet_pton(AF_INET6, text.c_str(), buffer) == 1) {
+        family = AF_INET6;
+        return true;
+    }
+    return false;
+}
+
+// Stub resolvers on the host cannot be reached through another interface
+bool loopback_address(const std::string& address) {
+    return address.compare(0, 4, "127.") == 0 || address == "::1";
+}
+
+// Space-separated values of KEY=... lines in a systemd state file
+std::vector<std::string> state_values(const std::string& path, const std::string& key) {
+    std::vector<std::string> values;
+    std::ifstream ifs(path);
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.compare(0, key.size() + 1, key + "=") != 0) continue;
+        std::istringstream items(line.substr(key.size() + 1));
+        std::string item;
+        while (items >> item) {
+            // resolved may add "#server-name" for DNS over TLS
+            item = item.substr(0, item.find('#'));
+            int family;
+            if (numeric_address(item, family)) values.push_back(item);
+        }
+    }
+    return values;
+}
+
+std::string encode_query(uint16_t id, const std::string& host, uint16_t type) {
+    std::string packet;
+    packet += static_cast<char>(id >> 8);
+    packet += static_cast<char>(id & 0xff);
+    packet += '\x01';   // recursion desired
+    packet += '\x00';
+    packet += std::string("\x00\x01\x00\x00\x00\x00\x00\x00", 8);  // one question
+    size_t start = 0;
+    while (start < host.size()) {
+        size_t dot = host.find('.', start);
+        if (dot == std::string::npos) dot = host.size();
+        packet += static_cast<char>(dot - start);
+        packet += host.substr(start, dot - start);
+        start = dot + 1;
+    }
+    packet += '\x00';
+    packet += static_cast<char>(type >> 8);
+    packet += static_cast<char>(type & 0xff);
+    packet += std::string("\x00\x01", 2);  // class IN
+    return packet;
+}
+
+// Steps over a possibly compressed name
+bool skip_name(const uint8_t* data, size_t len, size_t& pos) {
+    while (pos < len) {
+        uint8_t label = data[pos];
+        if ((label & 0xc0) == 0xc0) {
+            pos += 2;
+            return pos <= len;
+        }
+        pos += 1 + label;
+        if (label == 0) return pos <= len;
+    }
+    return false;
+}
+
+uint16_t read16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t read32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// A and AAAA records of a response; CNAMEs the server followed are skipped.
+// False when the packet is not a usable answer.
+bool parse_response(const uint8_t* data, size_t len, uint16_t& id, std::vector<Answer>& answers) {
+    if (len < 12) return false;
+    id = read16(data);
+    if (!(data[2] & 0x80)) return false;
+    uint8_t rcode = data[3] & 0x0f;
+    if (rcode != 0) return rcode == kRcodeNameError;
+    uint16_t questions = read16(data + 4);
+    uint16_t records = read16(data + 6);
+
+    size_t pos = 12;
+    for (uint16_t q = 0; q < questions; q++) {
+        if (!skip_name(data, len, pos)) return false;
+        pos += 4;
+    }
+    for (uint16_t r = 0; r < records; r++) {
+        if (!skip_name(data, len, pos) || pos + 10 > len) return false;
+        uint16_t type = read16(data + pos);
+        uint32_t ttl = read32(data + pos + 4);
+        uint16_t size = read16(data + pos + 8);
+        pos += 10;
+        if (pos + size > len) return false;
+        char text[INET6_ADDRSTRLEN];
+        if (type == kTypeA && size == 4 && inet_ntop(AF_INET, data + pos, text, sizeof(text))) {
+            answers.push_back({text, ttl});
+        } else if (type == kTypeAAAA && size == 16 && inet_ntop(AF_INET6, data + pos, text, sizeof(text))) {
+            answers.push_back({text, ttl});
+        }
+        pos += size;
+    }
+    return true;
+}
+
+// Asks one nameserver for host's A and AAAA records over a socket bound to
+// iface; true once it answered at least one of them (possibly with nothing)
+bool query_server(const std::string& iface, const std::string& server, const std::string& host,
+                  std::vector<Answer>& answers, std::string& error) {
+    int family;
+    if (!numeric_address(server, family)) return false;
+    struct sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t addr_len;
+    if (family == AF_INET) {
+        struct sockaddr_in* sin = reinterpret_cast<struct sockaddr_in*>(&addr);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(53);
+        inet_pton(AF_INET, server.c_str(), &sin->sin_addr);
+        addr_len = sizeof(*sin);
+    } else {
+        struct sockaddr_in6* sin6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(53);
+        inet_pton(AF_INET6, server.c_str(), &sin6->sin6_addr);
+        addr_len = sizeof(*sin6);
+    }
+
+    int fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    if (!bind_socket_to_interface(fd, iface)
+        || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0) {
+        error = "cannot reach nameserver " + server + " through " + iface + ": " + strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    std::random_device random;
+    uint16_t id = static_cast<uint16_t>(random());
+    uint16_t ids[2] = {id, static_cast<uint16_t>(id + 1)};
+    const uint16_t types[2] = {kTypeA, kTypeAAAA};
+    bool answered[2] = {false, false};
+    for (int i = 0; i < 2; i++) {
+        std::string query = encode_query(ids[i], host, types[i]);
+        if (send(fd, query.data(), query.size(), 0) < 0) {
+            error = "nameserver " + server + ": " + strerror(errno);
+            close(fd);
+            return false;
+        }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kQueryTimeoutMs);
+    while (!(answered[0] && answered[1])) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (left <= 0 || poll(&pfd, 1, static_cast<int>(left)) <= 0) break;
+        uint8_t buffer[4096];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) break;
+        uint16_t id;
+        std::vector<Answer> found;
+        if (!parse_response(buffer, static_cast<size_t>(n), id, found)) continue;
+        for (int i = 0; i < 2; i++) {
+            if (id != ids[i] || answered[i]) continue;
+            answered[i] = true;
+            answers.insert(answers.end(), found.begin(), found.end());
+        }
+    }
+    close(fd);
+    if (!answered[0] && !answered[1]) error = "nameserver " + server + " did not answer";
+    // One family answering is enough; the other may just be filtered
+    return answered[0] || answered[1];
+}
+
+// Starts a non-blocking connect bound to iface; -1 when it cannot
+int start_connect(const std::string& iface, const std::string& address, int port) {
+    int family;
+    if (!numeric_address(address, family)) return -1;
+    struct sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t addr_len;
+    if (family == AF_INET) {
+        struct sockaddr_in* sin = reinterpret_cast<struct sockaddr_in*>(&addr);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(static_cast<uint16_t>(port));
+        inet_pton(AF_INET, address.c_str(), &sin->sin_addr);
+        addr_len = sizeof(*sin);
+    } else {
+        struct sockaddr_in6* sin6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(static_cast<uint16_t>(port));
+        inet_pton(AF_INET6, address.c_str(), &sin6->sin6_addr);
+        addr_len = sizeof(*sin6);
+    }
+    int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (!bind_socket_to_interface(fd, iface)
+        || (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0 && errno != EINPROGRESS)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Happy Eyeballs over the candidates, IPv6 and IPv4 interleaved. Once one
+// connects, the others still in the air get as long as it took, so a
+// slightly later start does not cost a faster edge the race.
+bool race(const std::string& iface, const std::vector<std::string>& addresses, int port, Edge& edge) {
+    std::vector<std::string> v4, v6, order;
+    for (const auto& address : addresses) {
+        int family;
+        if (numeric_address(address, family)) (family == AF_INET6 ? v6 : v4).push_back(address);
+    }
+    for (size_t i = 0; i < std::max(v4.size(), v6.size()) && order.size() < kMaxCandidates; i++) {
+        if (i < v6.size()) order.push_back(v6[i]);
+        if (i < v4.size() && order.size() < kMaxCandidates) order.push_back(v4[i]);
+    }
+
+    struct Attempt {
+        int fd;
+        std::chrono::steady_clock::time_point started;
+        size_t candidate;
+    };
+    typedef std::chrono::steady_clock Clock;
+    std::vector<Attempt> attempts;
+    size_t next = 0;
+    auto begin = Clock::now();
+    auto next_start = begin;
+    auto limit = begin + std::chrono::milliseconds(kRaceTimeoutMs);
+    auto deadline = limit;
+    edge.address.clear();
+    edge.rtt = 0;
+    // With a winner, the race ends when the last attempt has had its time
+    auto update_deadline = [&]() {
+        if (edge.address.empty()) return;
+        auto latest = begin;
+        for (const auto& attempt : attempts) {
+            latest = std::max(latest, attempt.started);
+        }
+        deadline = std::min(limit, latest + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(edge.rtt)));
+    };
+
+    while (true) {
+        auto now = Clock::now();
+        if (next < order.size() && now >= next_start) {
+            int fd = start_connect(iface, order[next], port);
+            if (fd >= 0) attempts.push_back({fd, now, next});
+            next++;
+            next_start = now + std::chrono::milliseconds(kAttemptDelayMs);
+            update_deadline();
+            continue;
+        }
+        if ((attempts.empty() && next >= order.size()) || now >= deadline) break;
+
+        std::vector<struct pollfd> fds;
+        for (const auto& attempt : attempts) {
+            fds.push_back({attempt.fd, POLLOUT, 0});
+        }
+        auto until = next < order.size() ? std::min(next_start, deadline) : deadline;
+        int wait = static_cast<int>(std::max<int64_t>(0,
+            std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count()));
+        if (poll(fds.data(), fds.size(), wait) <= 0) continue;
+
+        auto done = Clock::now();
+        for (size_t i = fds.size(); i-- > 0;) {
+            if (!fds[i].revents) continue;
+            Attempt attempt = attempts[i];
+            attempts.erase(attempts.begin() + i);
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
+            getsockopt(attempt.fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+            close(attempt.fd);
+            if (so_error != 0) continue;
+            double rtt = std::chrono::duration<double>(done - attempt.started).count();
+            if (edge.address.empty() || rtt < edge.rtt) {
+                edge.address = order[attempt.candidate];
+                edge.rtt = rtt;
+            }
+        }
+        update_deadline();
+    }
+    for (const auto& attempt : attempts) {
+        close(attempt.fd);
+    }
+    return !edge.address.empty();
+}
+
+} // namespace
+
+std::vector<std::string> interface_dns_servers(const std::string& iface) {
+    unsigned index = if_nametoindex(iface.c_str());
+    if (index != 0) {
+        std::string n = std::to_string(index);
+        std::vector<std::string> servers = state_values("/run/systemd/netif/links/" + n, "DNS");
+        if (servers.empty()) servers = state_values("/run/systemd/resolve/netif/" + n, "SERVERS");
+        if (servers.empty()) servers = state_values("/run/systemd/netif/leases/" + n, "DNS");
+        if (!servers.empty()) return servers;
+    }
+
+    std::vector<std::string> servers;
+    std::ifstream ifs("/etc/resolv.conf");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::istringstream fields(line);
+        std::string keyword, address;
+        int family;
+        if (fields >> keyword >> address && keyword == "nameserver" && numeric_address(address, family)) {
+            servers.push_back(address);
+        }
+    }
+    return servers;
+}
+
+EdgeResolver& EdgeResolver::instance() {
+    static EdgeResolver resolver;
+    return resolver;
+}
+
+bool EdgeResolver::pick(const std::string& iface, const std::string& host, int port, Edge& edge,
+                        std::string& error) {
+    int family;
+    if (numeric_address(host, family)) {
+        error = "host is an address";
+        return false;
+    }
+    std::string key = iface + " " + host + ":" + std::to_string(port);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = cache.find(key);
+        if (found != cache.end() && std::chrono::steady_clock::now() < found->second.expires) {
+            edge = found->second.edge;
+            return true;
+        }
+    }
+
+    // Outside the lock: lanes resolve in parallel, each over its own link
+    std::vector<Answer> answers;
+    size_t tried = 0;
+    bool answered = false;
+    for (const auto& server : interface_dns_servers(iface)) {
+        if (loopback_address(server)) continue;
+        if (tried++ == kMaxServers) break;
+        if (query_server(iface, server, host, answers, error)) {
+            answered = true;
+            break;
+        }
+    }
+    if (!answered) {
+        if (tried == 0) error = "no nameserver of its own";
+        return false;
+    }
+    if (answers.empty()) {
+        error = "no address for " + host;
+        return false;
+    }
+
+    Entry entry;
+    uint32_t ttl = kMaxTtlSeconds;
+    for (const auto& answer : answers) {
+        if (std::find(entry.addresses.begin(), entry.addresses.end(), answer.address) == entry.addresses.end()) {
+            entry.addresses.push_back(answer.address);
+        }
+        ttl = std::min(ttl, answer.ttl);
+    }
+    if (!race(iface, entry.addresses, port, entry.edge)) {
+        error = "none of " + std::to_string(entry.addresses.size()) + " address(es) of " + host
+            + " connects";
+        return false;
+    }
+    entry.expires = std::chrono::steady_clock::now() + std::chrono::seconds(std::max(ttl, kMinTtlSeconds));
+    edge = entry.edge;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    cache[key] = entry;
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+// Nameservers of one interface from systemd-networkd or systemd-resolved
+// per-link state, falling back to the global ones in /etc/resolv.conf
+std::vector<std::string> interface_dns_servers(const std::string& iface);
+
+// Address an interface should connect to for a host, and how long the
+// TCP handshake to it took
+struct Edge {
+    std::string address;    // numeric IPv4 or IPv6
+    double rtt;             // seconds
+};
+
+// Resolves hosts through each interface's own DNS servers, with the
+// queries bound to that interface, so every link reaches the CDN edge its
+// provider routes it to rather than the one the system resolver picked.
+// The candidates race (Happy Eyeballs, IPv6 and IPv4 interleaved) and the
+// first to complete its handshake is the interface's edge. Answers and
+// winners are cached per interface and host for the records' TTL.
+// Thread-safe.
+class EdgeResolver {
+public:
+    static EdgeResolver& instance();
+
+    // False, with a reason, when the interface has no nameserver it can
+    // reach or no candidate connects; callers then use the system resolver
+    bool pick(const std::string& iface, const std::string& host, int port, Edge& edge,
+              std::string& error);
+
+private:
+    struct Entry {
+        std::vector<std::string> addresses;
+        Edge edge;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Entry> cache;     // by "iface host:port"
+
+    EdgeResolver() {}
+    EdgeResolver(const EdgeResolver&);
+    EdgeResolver& operator=(const EdgeResolver&);
+};
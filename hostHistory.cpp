@@ -0,0 +1,122 @@
+#include "hostHistory.h"
+
+#include <fstream>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <cstdio>
+#include <json/json.h>
+
+namespace {
+
+// An old value's weight halves with every day of age; a fresh one still
+// only counts as much as the new sample
+const double kHalfLifeSeconds = 24 * 3600.0;
+const double kFreshWeight = 0.5;
+
+const int64_t kMaxAgeSeconds = 30 * 24 * 3600;
+
+// Engines of one process (the download queue) share the file
+std::mutex g_history_mutex;
+
+Json::Value load_root(const std::string& path) {
+    Json::Value root;
+    std::ifstream ifs(path);
+    Json::Reader reader;
+    if (!ifs.is_open() || !reader.parse(ifs, root) || !root.isObject()) return Json::Value(Json::objectValue);
+    return root;
+}
+
+HostRecord parse_record(const Json::Value& value) {
+    return HostRecord{value["goodput"].asDouble(), value["rtt"].asDouble(), value["connections"].asInt(),
+                      value["updated"].asInt64(), value["samples"].asInt()};
+}
+
+} // namespace
+
+std::string url_host(const std::string& url) {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    size_t end = url.find_first_of("/?#", start);
+    std::string authority = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    // Credentials must not reach the history file, logs or traces
+    return authority.substr(authority.rfind('@') + 1);
+}
+
+HostHistory::HostHistory(const std::string& path) : history_path(path) {}
+
+std::map<std::string, HostRecord> HostHistory::lookup(const std::string& host, int64_t max_age) const {
+    std::map<std::string, HostRecord> records;
+    Json::Value root;
+    {
+        std::lock_guard<std::mutex> lock(g_history_mutex);
+        root = load_root(history_path);
+    }
+    const Json::Value& interfaces = root["hosts"][host];
+    if (!interfaces.isObject()) return records;
+
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+    for (const auto& name : interfaces.getMemberNames()) {
+        HostRecord record = parse_record(interfaces[name]);
+        if (record.goodput > 0 && now - record.updated <= max_age) records[name] = record;
+    }
+    return records;
+}
+
+bool HostHistory::update(const std::string& host, const std::map<std::string, HostRecord>& samples) {
+    std::lock_guard<std::mutex> lock(g_history_mutex);
+    Json::Value root = load_root(history_path);
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+
+    Json::Value& interfaces = root["hosts"][host];
+    for (const auto& sample : samples) {
+        HostRecord record = sample.second;
+        if (interfaces.isMember(sample.first)) {
+            HostRecord old = parse_record(interfaces[sample.first]);
+            double age = static_cast<double>(std::max<int64_t>(0, now - old.updated));
+            double keep = kFreshWeight * std::pow(0.5, age / kHalfLifeSeconds);
+            record.goodput = keep * old.goodput + (1 - keep) * record.goodput;
+            // A download that opened no connection says nothing about the RTT
+            if (record.rtt <= 0) {
+                record.rtt = old.rtt;
+            } else if (old.rtt > 0) {
+                record.rtt = keep * old.rtt + (1 - keep) * record.rtt;
+            }
+            record.connections = static_cast<int>(
+                std::lround(keep * old.connections + (1 - keep) * record.connections));
+            record.samples = old.samples + 1;
+        } else {
+            record.samples = 1;
+        }
+        record.updated = now;
+
+        Json::Value value;
+        value["goodput"] = record.goodput;
+        value["rtt"] = record.rtt;
+        value["connections"] = record.connections;
+        value["updated"] = Json::Int64(record.updated);
+        value["samples"] = record.samples;
+        interfaces[sample.first] = value;
+    }
+
+    // Forget hosts and interfaces that have not been seen for a long time
+    Json::Value& hosts = root["hosts"];
+    for (const auto& name : hosts.getMemberNames()) {
+        Json::Value& entries = hosts[name];
+        for (const auto& iface : entries.getMemberNames()) {
+            if (now - entries[iface]["updated"].asInt64() > kMaxAgeSeconds) entries.removeMember(iface);
+        }
+        if (entries.empty()) hosts.removeMember(name);
+    }
+
+    std::string tmp_path = history_path + ".tmp";
+    {
+        std::ofstream file(tmp_path);
+        if (!file) return false;
+        Json::FastWriter writer;
+        file << writer.write(root);
+        if (!file) return false;
+    }
+    return std::rename(tmp_path.c_str(), history_path.c_str()) == 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+// Where the engine keeps what it learned about each server by default,
+// next to networks.json
+const char* const kDefaultHistoryFile = "mush-history.json";
+
+// Records younger than this stand in for a fresh measurement
+const int64_t kRecentHistorySeconds = 6 * 3600;
+
+// "host[:port]" of a URL, without any user:password@: the key records are
+// stored under
+std::string url_host(const std::string& url);
+
+// How one interface performed against one host, decayed over past downloads
+struct HostRecord {
+    double goodput;     // bytes/s while the interface had transfers in flight
+    double rtt;         // seconds, TCP handshake; 0 when no connection was timed
+    int connections;    // where the connection tuner settled
+    int64_t updated;    // unix time of the last download that fed it
+    int samples;        // downloads folded in
+};
+
+// Small JSON store of HostRecords keyed by host[:port] and interface. Each
+// download folds its measurements in; older values count for less the
+// longer ago they were taken, and records nobody refreshed for a month are
+// dropped. Saves reload the file first and replace it atomically, so
+// engines in one process never lose each other's updates.
+class HostHistory {
+public:
+    explicit HostHistory(const std::string& path);
+
+    // Records of host no older than max_age seconds, by interface
+    std::map<std::string, HostRecord> lookup(const std::string& host, int64_t max_age) const;
+
+    // Folds one download's measurements of host in, by interface
+    bool update(const std::string& host, const std::map<std::string, HostRecord>& samples);
+
+    const std::string& path() const { return history_path; }
+
+private:
+    std::string history_path;
+};
@@ -0,0 +1,89 @@
+#include "interfaceInfo.h"
+
+#include <algorithm>
+#include <utility>
+#include <cstring>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+std::vector<std::string> list_interfaces() {
+    std::vector<std::pair<unsigned, std::string>> found;
+    struct ifaddrs* addrs = nullptr;
+    if (getifaddrs(&addrs) != 0) return std::vector<std::string>();
+
+    // AF_PACKET entries list every link, including ones without an address
+    for (struct ifaddrs* a = addrs; a != nullptr; a = a->ifa_next) {
+        if (a->ifa_flags & IFF_LOOPBACK) continue;
+        std::string name = a->ifa_name;
+        bool seen = false;
+        for (const auto& f : found) {
+            if (f.second == name) seen = true;
+        }
+        if (!seen) found.push_back(std::make_pair(if_nametoindex(a->ifa_name), name));
+    }
+    freeifaddrs(addrs);
+
+    std::sort(found.begin(), found.end());
+    std::vector<std::string> names;
+    for (const auto& f : found) {
+        names.push_back(f.second);
+    }
+    return names;
+}
+
+std::string interface_ipv4(const std::string& iface) {
+    struct ifaddrs* addrs = nullptr;
+    if (getifaddrs(&addrs) != 0) return "";
+
+    std::string address;
+    for (struct ifaddrs* a = addrs; a != nullptr; a = a->ifa_next) {
+        if (!a->ifa_addr || a->ifa_addr->sa_family != AF_INET) continue;
+        if (iface != a->ifa_name) continue;
+        char ip[INET_ADDRSTRLEN];
+        const struct sockaddr_in* sin = reinterpret_cast<const struct sockaddr_in*>(a->ifa_addr);
+        if (inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip))) {
+            address = ip;
+            break;
+        }
+    }
+    freeifaddrs(addrs);
+    return address;
+}
+
+bool interface_up(const std::string& iface) {
+    struct ifaddrs* addrs = nullptr;
+    if (getifaddrs(&addrs) != 0) return false;
+
+    bool up = false;
+    for (struct ifaddrs* a = addrs; a != nullptr; a = a->ifa_next) {
+        if (iface != a->ifa_name) continue;
+        up = (a->ifa_flags & IFF_UP) && (a->ifa_flags & IFF_RUNNING);
+        break;
+    }
+    freeifaddrs(addrs);
+    return up;
+}
+
+std::string interface_binding(const std::string& iface) {
+    // SO_BINDTODEVICE needs CAP_NET_RAW, which we have when run with sudo
+    if (geteuid() == 0) return "if!" + iface;
+
+    std::string ip = interface_ipv4(iface);
+    return ip.empty() ? "" : "host!" + ip;
+}
+
+bool bind_socket_to_interface(int fd, const std::string& iface) {
+    if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, iface.c_str(), iface.size()) == 0) return true;
+
+    std::string ip = interface_ipv4(iface);
+    if (ip.empty()) return false;
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    inet_pton(AF_INET, ip.c_str(), &local.sin_addr);
+    return bind(fd, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) == 0;
+}
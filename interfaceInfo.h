@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Names of all non-loopback interfaces, up or down, in kernel index order
+std::vector<std::string> list_interfaces();
+
+// First IPv4 address of an interface, empty when it has none
+std::string interface_ipv4(const std::string& iface);
+
+// Interface exists, is administratively up and has carrier
+bool interface_up(const std::string& iface);
+
+// Value for CURLOPT_INTERFACE binding a connection to the given interface:
+// SO_BINDTODEVICE when running as root, otherwise its IPv4 source address.
+// Empty when the interface has no usable address.
+std::string interface_binding(const std::string& iface);
+
+// Pin a socket to an interface before connect/send: SO_BINDTODEVICE when
+// permitted, otherwise bind to the interface's IPv4 address
+bool bind_socket_to_interface(int fd, const std::string& iface);
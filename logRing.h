@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <cstddef>
+
+// Bounded buffer between threads that produce log lines and one consumer
+// that drains them in batches. When the consumer falls behind, the oldest
+// lines are dropped and counted instead of letting memory grow.
+class LogRing {
+public:
+    explicit LogRing(size_t capacity) : capacity(capacity), dropped(0) {}
+
+    void push(const std::string& line) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (lines.size() >= capacity) {
+            lines.pop_front();
+            dropped++;
+        }
+        lines.push_back(line);
+    }
+
+    // Moves everything queued into out; returns how many lines were dropped
+    // since the last drain
+    size_t drain(std::vector<std::string>& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        out.assign(lines.begin(), lines.end());
+        lines.clear();
+        size_t lost = dropped;
+        dropped = 0;
+        return lost;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<std::string> lines;
+    size_t capacity;
+    size_t dropped;
+};
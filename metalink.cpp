@@ -0,0 +1,168 @@
+#include "metalink.h"
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// One start tag with its attributes and the text right after it
+struct Tag {
+    std::string name;
+    std::map<std::string, std::string> attributes;
+    std::string text;
+};
+
+std::string unescape(const std::string& text) {
+    static const std::pair<const char*, char> entities[] = {
+        {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}
+    };
+    std::string out;
+    for (size_t i = 0; i < text.size(); i++) {
+        bool replaced = false;
+        if (text[i] == '&') {
+            for (const auto& entity : entities) {
+                size_t len = strlen(entity.first);
+                if (text.compare(i, len, entity.first) == 0) {
+                    out += entity.second;
+                    i += len - 1;
+                    replaced = true;
+                    break;
+                }
+            }
+        }
+        if (!replaced) out += text[i];
+    }
+    return out;
+}
+
+std::string trim(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) return "";
+    return text.substr(start, text.find_last_not_of(" \t\r\n") - start + 1);
+}
+
+// Start tags in document order, with namespace prefixes removed. Enough
+// for Metalink, which has no mixed content worth keeping.
+std::vector<Tag> scan_tags(const std::string& xml) {
+    std::vector<Tag> tags;
+    size_t pos = 0;
+    while ((pos = xml.find('<', pos)) != std::string::npos) {
+        size_t close = xml.find('>', pos);
+        if (close == std::string::npos) break;
+        std::string inside = xml.substr(pos + 1, close - pos - 1);
+        pos = close + 1;
+        if (inside.empty() || inside[0] == '/' || inside[0] == '?' || inside[0] == '!') continue;
+
+        Tag tag;
+        size_t name_end = inside.find_first_of(" \t\r\n/");
+        tag.name = inside.substr(0, name_end);
+        size_t colon = tag.name.find(':');
+        if (colon != std::string::npos) tag.name = tag.name.substr(colon + 1);
+
+        // name="value" or name='value'
+        size_t at = name_end;
+        while (at != std::string::npos && at < inside.size()) {
+            size_t eq = inside.find('=', at);
+            if (eq == std::string::npos || eq + 1 >= inside.size()) break;
+            std::string key = trim(inside.substr(at, eq - at));
+            char quote = inside[eq + 1];
+            size_t end = inside.find(quote, eq + 2);
+            if ((quote != '"' && quote != '\'') || end == std::string::npos) break;
+            tag.attributes[key] = unescape(inside.substr(eq + 2, end - eq - 2));
+            at = end + 1;
+        }
+
+        size_t next = xml.find('<', pos);
+        tag.text = trim(unescape(xml.substr(pos, next == std::string::npos ? std::string::npos : next - pos)));
+        tags.push_back(tag);
+    }
+    return tags;
+}
+
+} // namespace
+
+bool is_metalink_path(const std::string& path) {
+    auto ends_with = [&path](const std::string& suffix) {
+        return path.size() >= suffix.size()
+            && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    return ends_with(".meta4") || ends_with(".metalink");
+}
+
+bool load_metalink(const std::string& path, MetalinkFile& file, std::string& error) {
+    std::ifstream ifs(path);
+    if (!ifs.is_open()) {
+        error = "Could not open " + path;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << ifs.rdbuf();
+
+    file.name.clear();
+    file.size = -1;
+    file.sha256.clear();
+    file.urls.clear();
+
+    // Metalink 4 ranks by priority (1 is best), Metalink 3 by preference
+    // (100 is best); both become one ascending key
+    std::vector<std::pair<int, std::string>> ranked;
+    bool in_file = false;
+    for (const auto& tag : scan_tags(buffer.str())) {
+        if (tag.name == "file") {
+            if (in_file) break;
+            in_file = true;
+            auto name = tag.attributes.find("name");
+            if (name != tag.attributes.end()) file.name = name->second;
+            continue;
+        }
+        if (!in_file) continue;
+
+        if (tag.name == "size") {
+            char* end = nullptr;
+            file.size = std::strtoll(tag.text.c_str(), &end, 10);
+            if (tag.text.empty() || *end != '\0' || file.size < 0) {
+                error = path + ": invalid size \"" + tag.text + "\"";
+                return false;
+            }
+        } else if (tag.name == "hash") {
+            auto type = tag.attributes.find("type");
+            if (type != tag.attributes.end() && (type->second == "sha-256" || type->second == "sha256")) {
+                if (tag.text.size() != 64
+                    || tag.text.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+                    error = path + ": sha-256 hash needs 64 hex digits";
+                    return false;
+                }
+                file.sha256 = tag.text;
+                std::transform(file.sha256.begin(), file.sha256.end(), file.sha256.begin(), ::tolower);
+            }
+        } else if (tag.name == "url") {
+            if (tag.text.compare(0, 7, "http://") != 0 && tag.text.compare(0, 8, "https://") != 0) continue;
+            int rank = 999999;
+            auto priority = tag.attributes.find("priority");
+            auto preference = tag.attributes.find("preference");
+            if (priority != tag.attributes.end()) {
+                rank = std::atoi(priority->second.c_str());
+            } else if (preference != tag.attributes.end()) {
+                rank = 101 - std::atoi(preference->second.c_str());
+            }
+            ranked.push_back({rank, tag.text});
+        }
+    }
+
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const std::pair<int, std::string>& a, const std::pair<int, std::string>& b) {
+                         return a.first < b.first;
+                     });
+    for (const auto& entry : ranked) {
+        file.urls.push_back(entry.second);
+    }
+    if (file.urls.empty()) {
+        error = path + " lists no http(s) URL";
+        return false;
+    }
+    return true;
+}
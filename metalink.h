@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// First file described by a Metalink document
+struct MetalinkFile {
+    std::string name;
+    int64_t size;                   // -1 when not given
+    std::string sha256;             // lowercase hex; empty when not given
+    std::vector<std::string> urls;  // most preferred first
+};
+
+// Reads a Metalink 4 (.meta4, RFC 5854) or Metalink 3 (.metalink) file.
+// Only http(s) URLs are kept.
+bool load_metalink(const std::string& path, MetalinkFile& file, std::string& error);
+
+// Metalink files are recognised by extension
+bool is_metalink_path(const std::string& path);
@@ -0,0 +1,81 @@
+#include "monitorClient.h"
+
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <json/json.h>
+
+MonitorClient::MonitorClient() : fd(-1), running(false) {}
+
+MonitorClient::~MonitorClient() {
+    stop();
+}
+
+bool MonitorClient::start(const std::string& path, Callback cb) {
+    stop();
+
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    struct ucred peer;
+    socklen_t len = sizeof(peer);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &len) != 0
+        || (peer.uid != 0 && peer.uid != getuid())) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    callback = cb;
+    running = true;
+    reader = std::thread(&MonitorClient::read_loop, this);
+    return true;
+}
+
+void MonitorClient::stop() {
+    running = false;
+    if (reader.joinable()) reader.join();
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+void MonitorClient::read_loop() {
+    std::string pending;
+    char buffer[4096];
+    Json::Reader parser;
+
+    while (running) {
+        // Wake up regularly so stop() never waits on a quiet daemon
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0) break; // daemon went away
+
+        pending.append(buffer, n);
+        size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos) {
+            std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+
+            Json::Value root;
+            if (!parser.parse(line, root) || !root["networks"].isArray()) continue;
+            std::vector<LiveSample> samples;
+            for (const auto& net : root["networks"]) {
+                samples.push_back({net["interface"].asString(), net["speed"].asDouble(),
+                                   net["latency"].asDouble(), net["score"].asDouble()});
+            }
+            if (callback) callback(samples);
+        }
+    }
+    running = false;
+}
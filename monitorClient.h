@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+// Where `network --daemon` publishes live interface samples by default
+const char* const kDefaultMonitorSocket = "/run/mush/monitor.sock";
+
+// One interface's smoothed conditions from the live monitor
+struct LiveSample {
+    std::string interface;
+    double speed;   // EWMA KB/s
+    double latency; // EWMA ms, -1 when unknown
+    double score;
+};
+
+// Subscriber to the monitor daemon's Unix socket. The daemon pushes one JSON
+// line per sampling interval; each is parsed and handed to the callback on
+// the client's reader thread. Only daemons run by root or the client's own
+// user are trusted.
+class MonitorClient {
+public:
+    typedef std::function<void(const std::vector<LiveSample>&)> Callback;
+
+    MonitorClient();
+    ~MonitorClient();
+
+    // False when no trusted daemon is listening on path
+    bool start(const std::string& path, Callback callback);
+    void stop();
+
+private:
+    int fd;
+    std::thread reader;
+    std::atomic<bool> running;
+    Callback callback;
+
+    void read_loop();
+
+    MonitorClient(const MonitorClient&);
+    MonitorClient& operator=(const MonitorClient&);
+};
@@ -0,0 +1,81 @@
+#include "networkConfig.h"
+
+#include <fstream>
+#include <cmath>
+#include <json/json.h>
+#include "interfaceInfo.h"
+
+namespace {
+
+NetworkInterface neutral_interface(const std::string& name) {
+    return NetworkInterface{name, 0, 0, 1.0, 0, 0, "", ""};
+}
+
+} // namespace
+
+bool load_networks(const std::string& path, std::vector<NetworkInterface>& networks,
+                   std::string& error) {
+    std::ifstream ifs(path);
+    if (!ifs.is_open()) {
+        error = "Could not open " + path;
+        return false;
+    }
+
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(ifs, root)) {
+        error = "Could not parse " + path;
+        return false;
+    }
+
+    if (root.isMember("networks") && root["networks"].isArray()) {
+        for (const auto& network : root["networks"]) {
+            NetworkInterface iface;
+            iface.interface = network["interface"].asString();
+            iface.latency = network["latency"].asDouble();
+            iface.quality = network["quality"].asInt();
+            iface.score = network["score"].asDouble();
+            iface.signal_strength = network["signal_strength"].asInt();
+            iface.speed = network["speed"].asDouble();
+            iface.ssid = network["ssid"].asString();
+            iface.type = network["type"].asString();
+            networks.push_back(iface);
+        }
+    }
+    return true;
+}
+
+std::vector<NetworkInterface> select_interfaces(const std::vector<NetworkInterface>& networks,
+                                                const std::vector<std::string>& names) {
+    std::vector<NetworkInterface> selected;
+    for (const auto& name : names) {
+        NetworkInterface iface = neutral_interface(name);
+        for (const auto& net : networks) {
+            if (net.interface == name) iface = net;
+        }
+        selected.push_back(iface);
+    }
+    return selected;
+}
+
+std::vector<NetworkInterface> unmeasured_interfaces() {
+    std::vector<NetworkInterface> networks;
+    for (const auto& name : list_interfaces()) {
+        networks.push_back(neutral_interface(name));
+    }
+    return networks;
+}
+
+std::vector<double> allocation_shares(const std::vector<NetworkInterface>& networks) {
+    // Absolute values, as a score of 0 or below still means a usable link
+    double total_score = 0;
+    for (const auto& net : networks) {
+        total_score += std::abs(net.score);
+    }
+
+    std::vector<double> shares;
+    for (const auto& net : networks) {
+        shares.push_back(total_score > 0 ? (std::abs(net.score) / total_score) * 100 : 0);
+    }
+    return shares;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// One interface as measured by `network` and stored in networks.json
+struct NetworkInterface {
+    std::string interface;
+    double latency;
+    int quality;
+    double score;
+    int signal_strength;
+    double speed;
+    std::string ssid;
+    std::string type;
+};
+
+// Read the interface list written by `network`
+bool load_networks(const std::string& path, std::vector<NetworkInterface>& networks,
+                   std::string& error);
+
+// Interfaces named in names, in that order. Names that were not measured
+// get a neutral entry so they still take an equal share of the work.
+std::vector<NetworkInterface> select_interfaces(const std::vector<NetworkInterface>& networks,
+                                                const std::vector<std::string>& names);
+
+// Every interface on the host with a neutral score, for running without a
+// networks.json
+std::vector<NetworkInterface> unmeasured_interfaces();
+
+// Percentage of the file each interface is initially assigned, by score
+std::vector<double> allocation_shares(const std::vector<NetworkInterface>& networks);
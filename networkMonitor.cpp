@@ -2,112 +2,645 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <map>
 #include <string>
 #include <thread>
 #include <chrono>
 #include <cstdlib>
-#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/ip_icmp.h>
+#include <csignal>
+#include <ctime>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <json/json.h>
+#include <curl/curl.h>
+#include "interfaceInfo.h"
+#include "monitorClient.h"
+#include "hostHistory.h"
 
-// Execute a shell command and return its output
-std::string execCmd(const std::string& cmd) {
-    std::array<char, 128> buffer;
-    std::string result;
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) throw std::runtime_error("popen() failed!");
-    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-        result += buffer.data();
-    }
-    pclose(pipe);
-    return result;
+// Measurement settings, overridable from the command line
+struct ProbeConfig {
+    double window_seconds = 8.0;   // longest time to watch an interface
+    double min_seconds = 2.0;      // shortest time before an early exit
+    double sample_seconds = 0.5;   // /proc/net/dev polling interval
+    double stable_ratio = 0.10;    // max relative spread of the last estimates
+    std::string probe_url;         // non-empty enables the active probe
+    long probe_bytes = 4 * 1024 * 1024;
+    std::string history_path = kDefaultHistoryFile; // downloads' record of the probe host
+    std::string ping_target = "8.8.8.8";
+    std::string tcp_target;        // host:port for the TCP connect fallback
+    int ping_count = 5;
+    bool daemon = false;           // keep sampling and publish live EWMAs
+    double interval_seconds = 1.0;
+    double alpha = 0.3;            // EWMA weight of the newest sample
+    std::string socket_path = kDefaultMonitorSocket;
+};
+
+// Round-trip statistics over several samples, in ms
+struct LatencyStats {
+    int samples;
+    double min;
+    double median;
+    double jitter; // mean difference between consecutive samples
+};
+
+uint16_t icmpChecksum(const uint8_t* data, size_t len) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < len; i += 2) sum += (data[i] << 8) | data[i + 1];
+    if (len & 1) sum += data[len - 1] << 8;
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return htons(static_cast<uint16_t>(~sum));
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
 }
 
-// Get latency via ping (1 packet)
-double getLatency(const std::string& iface) {
-    try {
-        std::string cmd = "ping -I " + iface + " -c 1 -w 1 8.8.8.8 2>/dev/null | grep 'time='";
-        std::string output = execCmd(cmd);
+// Unprivileged ICMP datagram socket when ping_group_range allows it, raw
+// socket otherwise (root)
+int openIcmpSocket(bool& raw) {
+    raw = false;
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_ICMP);
+    if (fd >= 0) return fd;
+    raw = true;
+    return socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMP);
+}
 
-        size_t pos = output.find("time=");
-        if (pos == std::string::npos) return -1.0;
+// One ICMP echo through iface; RTT in ms or -1 on timeout/error
+double icmpEcho(int fd, bool raw, const sockaddr_in& dst, uint16_t id, uint16_t seq, int timeout_ms) {
+    uint8_t packet[64] = {0};
+    struct icmphdr* hdr = reinterpret_cast<struct icmphdr*>(packet);
+    hdr->type = ICMP_ECHO;
+    hdr->un.echo.id = htons(id);
+    hdr->un.echo.sequence = htons(seq);
+    hdr->checksum = icmpChecksum(packet, sizeof(packet));
 
-        size_t end = output.find(" ms", pos);
-        std::string t = output.substr(pos + 5, end - (pos + 5));
-        return std::stod(t);
-    } catch (...) {
+    auto sent = std::chrono::steady_clock::now();
+    if (sendto(fd, packet, sizeof(packet), 0, reinterpret_cast<const sockaddr*>(&dst), sizeof(dst)) < 0) {
         return -1.0;
     }
+
+    uint8_t reply[1500];
+    while (true) {
+        int remaining = timeout_ms - static_cast<int>(elapsedMs(sent));
+        if (remaining <= 0) return -1.0;
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, remaining) <= 0) return -1.0;
+
+        ssize_t n = recv(fd, reply, sizeof(reply), 0);
+        if (n <= 0) continue;
+        size_t offset = 0;
+        if (raw) offset = (reply[0] & 0x0f) * 4; // raw sockets include the IP header
+        if (static_cast<size_t>(n) < offset + sizeof(struct icmphdr)) continue;
+
+        const struct icmphdr* echo = reinterpret_cast<const struct icmphdr*>(reply + offset);
+        // Datagram sockets rewrite the id, so only raw replies can be matched on it
+        if (echo->type != ICMP_ECHOREPLY || ntohs(echo->un.echo.sequence) != seq) continue;
+        if (raw && ntohs(echo->un.echo.id) != id) continue;
+        return elapsedMs(sent);
+    }
 }
 
-// Get throughput in KB/s using /proc/net/dev delta over 8 seconds
-double getThroughput(const std::string& iface) {
-    auto readBytes = [&](const std::string& iface) -> uint64_t {
-        std::ifstream file("/proc/net/dev");
-        std::string line;
-        while (std::getline(file, line)) {
-            if (line.find(iface + ":") != std::string::npos) {
-                std::istringstream ss(line.substr(line.find(":") + 1));
-                uint64_t rx = 0, tx = 0;
-                ss >> rx;
-                for (int i = 0; i < 7; i++) ss >> std::ws >> rx; // skip to tx bytes
-                ss >> tx;
-                return rx + tx;
-            }
+// TCP handshake time through iface; a refused connection still took one RTT
+double tcpConnectRtt(const std::string& iface, const sockaddr_in& dst, int timeout_ms) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1.0;
+    if (!bind_socket_to_interface(fd, iface)) {
+        close(fd);
+        return -1.0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    double rtt = -1.0;
+    int rc = connect(fd, reinterpret_cast<const sockaddr*>(&dst), sizeof(dst));
+    if (rc == 0) {
+        rtt = elapsedMs(start);
+    } else if (errno == EINPROGRESS) {
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if (poll(&pfd, 1, timeout_ms) == 1) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0 || err == ECONNREFUSED) rtt = elapsedMs(start);
         }
-        return 0;
-    };
+    }
+    close(fd);
+    return rtt;
+}
 
+bool resolveIPv4(const std::string& host, const std::string& port, sockaddr_in& out) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), port.empty() ? nullptr : port.c_str(), &hints, &res) != 0 || !res) {
+        return false;
+    }
+    memcpy(&out, res->ai_addr, sizeof(out));
+    freeaddrinfo(res);
+    return true;
+}
+
+LatencyStats summarize(std::vector<double> samples) {
+    LatencyStats stats = {static_cast<int>(samples.size()), -1.0, -1.0, 0.0};
+    if (samples.empty()) return stats;
+
+    for (size_t i = 1; i < samples.size(); i++) {
+        stats.jitter += std::fabs(samples[i] - samples[i - 1]);
+    }
+    if (samples.size() > 1) stats.jitter /= (samples.size() - 1);
+
+    std::sort(samples.begin(), samples.end());
+    stats.min = samples.front();
+    size_t mid = samples.size() / 2;
+    stats.median = samples.size() % 2 ? samples[mid] : (samples[mid - 1] + samples[mid]) / 2.0;
+    return stats;
+}
+
+// Get latency via ICMP echo through iface, sampled ping_count times; falls
+// back to TCP connect time to tcp_target when ICMP is blocked or unavailable
+LatencyStats getLatency(const std::string& iface, const ProbeConfig& config) {
+    const int kTimeoutMs = 1000;
+    const int kIntervalMs = 100;
+    std::vector<double> samples;
+
+    sockaddr_in dst;
+    bool raw = false;
+    int fd = resolveIPv4(config.ping_target, "", dst) ? openIcmpSocket(raw) : -1;
+    if (fd >= 0 && bind_socket_to_interface(fd, iface)) {
+        uint16_t id = static_cast<uint16_t>(getpid() ^ if_nametoindex(iface.c_str()));
+        for (int i = 0; i < config.ping_count; i++) {
+            double rtt = icmpEcho(fd, raw, dst, id, static_cast<uint16_t>(i + 1), kTimeoutMs);
+            if (rtt >= 0) samples.push_back(rtt);
+            else if (samples.empty()) break; // unreachable, do not wait out every sample
+            std::this_thread::sleep_for(std::chrono::milliseconds(kIntervalMs));
+        }
+    }
+    if (fd >= 0) close(fd);
+
+    size_t colon = config.tcp_target.rfind(':');
+    if (samples.empty() && colon != std::string::npos
+        && resolveIPv4(config.tcp_target.substr(0, colon), config.tcp_target.substr(colon + 1), dst)) {
+        for (int i = 0; i < config.ping_count; i++) {
+            double rtt = tcpConnectRtt(iface, dst, kTimeoutMs);
+            if (rtt >= 0) samples.push_back(rtt);
+            else if (samples.empty()) break;
+        }
+    }
+    return summarize(samples);
+}
+
+// Total rx+tx bytes of an interface from /proc/net/dev
+uint64_t readBytes(const std::string& iface) {
+    std::ifstream file("/proc/net/dev");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.find(iface + ":") != std::string::npos) {
+            std::istringstream ss(line.substr(line.find(":") + 1));
+            uint64_t rx = 0, tx = 0;
+            ss >> rx;
+            for (int i = 0; i < 7; i++) ss >> std::ws >> tx; // skip to tx bytes
+            ss >> tx;
+            return rx + tx;
+        }
+    }
+    return 0;
+}
+
+// Get throughput in KB/s using /proc/net/dev deltas. Samples every
+// sample_seconds and stops early once the last few running averages agree
+// within stable_ratio, or after window_seconds at the latest.
+double getThroughput(const std::string& iface, const ProbeConfig& config) {
+    const size_t kStableSamples = 3;
+    auto start = std::chrono::steady_clock::now();
     uint64_t b1 = readBytes(iface);
-    std::this_thread::sleep_for(std::chrono::seconds(8)); // measure over 8s
-    uint64_t b2 = readBytes(iface);
+    std::vector<double> estimates;
+    double elapsed = 0;
+    double rate = 0;
 
-    return static_cast<double>(b2 - b1) / (1024.0 * 8.0); // KB/s average
+    while (elapsed < config.window_seconds) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(config.sample_seconds));
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        rate = static_cast<double>(readBytes(iface) - b1) / (1024.0 * elapsed);
+        estimates.push_back(rate);
+
+        if (elapsed < config.min_seconds || estimates.size() < kStableSamples) continue;
+        auto recent = estimates.end() - kStableSamples;
+        double lo = *std::min_element(recent, estimates.end());
+        double hi = *std::max_element(recent, estimates.end());
+        if (hi <= 0.0 || (hi - lo) / hi <= config.stable_ratio) break;
+    }
+    return rate; // KB/s average
 }
 
-int main() {
-    Json::Value root;
-    root["networks"] = Json::arrayValue;
+// Result of downloading a bounded sample over one interface
+struct ActiveProbe {
+    bool ok;
+    double goodput; // KB/s from first byte to last
+    double rtt;     // ms, TCP handshake time
+};
+
+struct ProbeSink {
+    long received;
+    long limit;
+};
+
+size_t probeWrite(char*, size_t size, size_t nmemb, void* userdata) {
+    ProbeSink* sink = static_cast<ProbeSink*>(userdata);
+    sink->received += static_cast<long>(size * nmemb);
+    // Stop at the limit even if the server ignored the range
+    return sink->received >= sink->limit ? 0 : size * nmemb;
+}
+
+// Download up to probe_bytes of probe_url through iface to measure what the
+// link can actually deliver, independent of whatever traffic it carries now
+ActiveProbe getActiveThroughput(const std::string& iface, const ProbeConfig& config) {
+    ActiveProbe probe = {false, 0.0, -1.0};
+    CURL* curl = curl_easy_init();
+    if (!curl) return probe;
+
+    std::string binding = interface_binding(iface);
+    std::string range = "0-" + std::to_string(config.probe_bytes - 1);
+    ProbeSink sink = {0, config.probe_bytes};
 
-    std::string ifaceList = execCmd("ls /sys/class/net");
-    std::istringstream ss(ifaceList);
+    curl_easy_setopt(curl, CURLOPT_URL, config.probe_url.c_str());
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(config.window_seconds * 1000));
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(config.window_seconds * 2000));
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, probeWrite);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+    if (!binding.empty()) curl_easy_setopt(curl, CURLOPT_INTERFACE, binding.c_str());
+
+    CURLcode res = curl_easy_perform(curl);
+    bool reached_limit = res == CURLE_WRITE_ERROR && sink.received >= sink.limit;
+
+    if ((res == CURLE_OK || reached_limit) && sink.received > 0) {
+        curl_off_t lookup = 0, connect = 0, first_byte = 0, total = 0;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &lookup);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+        // Small samples can land in one burst; then count the whole request
+        double transfer_us = static_cast<double>(total - first_byte);
+        if (transfer_us < 10000) transfer_us = static_cast<double>(total);
+
+        probe.ok = true;
+        probe.goodput = sink.received / 1024.0 / (transfer_us / 1e6);
+        probe.rtt = (connect - lookup) / 1000.0;
+    }
+    curl_easy_cleanup(curl);
+    return probe;
+}
+
+// Effective KB/s for a 1 MiB request: one round trip plus the transfer time.
+// Keeps the score in the same unit as speed instead of subtracting ms from
+// KB/s; an unknown latency (-1) counts as zero.
+double computeScore(double speed, double latency) {
+    const double kRequestKB = 1024.0;
+    if (speed <= 0) return 0.0;
+    double seconds = std::max(0.0, latency) / 1000.0 + kRequestKB / speed;
+    return kRequestKB / seconds;
+}
+
+// Probe results for one interface, filled in by its own thread
+struct ProbeResult {
     std::string iface;
+    LatencyStats latency;
+    double speed;
+    double rtt;
+    std::string source;     // "active", "passive" or "history"
+};
+
+// Write networks.json via a temporary file so readers never see half of it
+bool saveNetworks(const Json::Value& root) {
+    {
+        std::ofstream file("networks.json.tmp");
+        if (!file) return false;
+        file << root.toStyledString();
+        if (!file) return false;
+    }
+    return std::rename("networks.json.tmp", "networks.json") == 0;
+}
+
+volatile std::sig_atomic_t g_daemon_stop = 0;
+
+void onDaemonSignal(int) {
+    g_daemon_stop = 1;
+}
 
-    while (ss >> iface) {
-        if (iface == "lo") continue; // skip loopback
+// Smoothed conditions of one interface in daemon mode
+struct LiveState {
+    uint64_t last_bytes;
+    double speed;
+    double latency;
+    bool have_latency;
+};
+
+// Long-running mode: every interval, sample the traffic counters and one RTT
+// per interface, fold them into EWMAs and push a JSON line to every client of
+// the Unix socket. networks.json is refreshed too, so a downloader started
+// later begins from current numbers.
+// The socket lives in a directory only the daemon's user can write to, so
+// nobody else can replace it; missing directories are created that way
+bool prepareSocketDirectory(const std::string& socket_path) {
+    size_t slash = socket_path.find_last_of('/');
+    if (slash == std::string::npos || slash == 0) return true;
+    std::string dir = socket_path.substr(0, slash);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create " << dir << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        std::cerr << dir << " is not a directory" << std::endl;
+        return false;
+    }
+    if ((st.st_uid != geteuid() && st.st_uid != 0) || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        std::cerr << "Refusing to publish in " << dir << ": writable by other users" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int runDaemon(const std::vector<std::string>& ifaces, const ProbeConfig& config) {
+    struct sockaddr_un addr;
+    if (config.socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << config.socket_path << std::endl;
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, config.socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    if (!prepareSocketDirectory(config.socket_path)) return 1;
+
+    // Owner and group only: members of the daemon's group may subscribe
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(config.socket_path.c_str());
+    mode_t old_mask = umask(0117);
+    bool listening = server >= 0 && bind(server, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0
+                     && listen(server, 16) == 0;
+    umask(old_mask);
+    if (!listening) {
+        std::cerr << "Failed to listen on " << config.socket_path << ": " << strerror(errno) << std::endl;
+        if (server >= 0) close(server);
+        return 1;
+    }
+
+    std::signal(SIGINT, onDaemonSignal);
+    std::signal(SIGTERM, onDaemonSignal);
+    std::cout << "Publishing live interface stats on " << config.socket_path << std::endl;
+
+    std::vector<LiveState> states;
+    for (const auto& iface : ifaces) {
+        states.push_back({readBytes(iface), 0.0, -1.0, false});
+    }
+    std::vector<int> clients;
+    ProbeConfig single = config;
+    single.ping_count = 1;
+    auto last_tick = std::chrono::steady_clock::now();
+
+    while (!g_daemon_stop) {
+        // RTT samples run in parallel while the counters accumulate
+        std::vector<double> rtts(ifaces.size(), -1.0);
+        std::vector<std::thread> pings;
+        for (size_t i = 0; i < ifaces.size(); i++) {
+            pings.push_back(std::thread([&rtts, &ifaces, &single, i]() {
+                rtts[i] = getLatency(ifaces[i], single).median;
+            }));
+        }
+        for (auto& ping : pings) {
+            ping.join();
+        }
+
+        auto next_tick = last_tick + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(config.interval_seconds));
+        std::this_thread::sleep_until(next_tick);
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - last_tick).count();
+        last_tick = now;
+
+        Json::Value root;
+        root["time"] = static_cast<Json::Int64>(std::time(nullptr));
+        root["networks"] = Json::arrayValue;
+        for (size_t i = 0; i < ifaces.size(); i++) {
+            LiveState& st = states[i];
+            uint64_t bytes = readBytes(ifaces[i]);
+            double rate = static_cast<double>(bytes - st.last_bytes) / (1024.0 * dt);
+            st.last_bytes = bytes;
+            st.speed = config.alpha * rate + (1.0 - config.alpha) * st.speed;
+            if (rtts[i] >= 0) {
+                st.latency = st.have_latency
+                    ? config.alpha * rtts[i] + (1.0 - config.alpha) * st.latency
+                    : rtts[i];
+                st.have_latency = true;
+            }
+
+            Json::Value net;
+            net["interface"] = ifaces[i];
+            net["ssid"] = "";
+            net["type"] = (ifaces[i].find("wl") == 0) ? "wifi" : "ethernet";
+            net["speed"] = st.speed;
+            net["latency"] = st.latency;
+            net["signal_strength"] = -1; // placeholder
+            net["quality"] = 0;          // placeholder
+            net["score"] = computeScore(st.speed, st.latency);
+            root["networks"].append(net);
+        }
+
+        int client;
+        while ((client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+            clients.push_back(client);
+        }
+
+        // A subscriber that cannot keep up with one line per interval is dropped
+        Json::FastWriter writer;
+        std::string line = writer.write(root);
+        for (size_t i = 0; i < clients.size();) {
+            ssize_t sent = send(clients[i], line.data(), line.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent != static_cast<ssize_t>(line.size())) {
+                close(clients[i]);
+                clients.erase(clients.begin() + i);
+            } else {
+                i++;
+            }
+        }
+
+        saveNetworks(root);
+    }
+
+    for (int c : clients) {
+        close(c);
+    }
+    close(server);
+    unlink(config.socket_path.c_str());
+    std::cout << "Monitor stopped" << std::endl;
+    return 0;
+}
+
+void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--window SECONDS] [--min-window SECONDS]"
+              << " [--probe-url URL] [--probe-bytes BYTES] [--history FILE|--no-history]"
+              << " [--ping-target IP] [--ping-count N] [--tcp-target HOST:PORT]"
+              << " [--daemon [--interval SECONDS] [--alpha A] [--socket PATH]]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    ProbeConfig config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--window" || arg == "--min-window") && i + 1 < argc) {
+            double value = std::atof(argv[++i]);
+            if (value <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            if (arg == "--window") config.window_seconds = value;
+            else config.min_seconds = value;
+        } else if (arg == "--history" && i + 1 < argc) {
+            config.history_path = argv[++i];
+        } else if (arg == "--no-history") {
+            config.history_path.clear();
+        } else if (arg == "--probe-url" && i + 1 < argc) {
+            config.probe_url = argv[++i];
+        } else if (arg == "--probe-bytes" && i + 1 < argc) {
+            config.probe_bytes = std::atol(argv[++i]);
+            if (config.probe_bytes <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--ping-target" && i + 1 < argc) {
+            config.ping_target = argv[++i];
+        } else if (arg == "--tcp-target" && i + 1 < argc) {
+            config.tcp_target = argv[++i];
+        } else if (arg == "--ping-count" && i + 1 < argc) {
+            config.ping_count = std::atoi(argv[++i]);
+            if (config.ping_count <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--daemon") {
+            config.daemon = true;
+        } else if ((arg == "--interval" || arg == "--alpha") && i + 1 < argc) {
+            double value = std::atof(argv[++i]);
+            if (value <= 0 || (arg == "--alpha" && value > 1)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            if (arg == "--interval") config.interval_seconds = value;
+            else config.alpha = value;
+        } else if (arg == "--socket" && i + 1 < argc) {
+            config.socket_path = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    config.min_seconds = std::min(config.min_seconds, config.window_seconds);
+
+    Json::Value root;
+    root["networks"] = Json::arrayValue;
+
+    std::vector<std::string> ifaces;
+    for (const auto& iface : list_interfaces()) {
         if (iface.length() <= 6) {
             std::cerr << "Skipping short interface name: " << iface << std::endl;
             continue;
         }
+        ifaces.push_back(iface);
+    }
 
-        Json::Value net;
-        net["interface"] = iface;
-        net["ssid"] = "";
-        net["type"] = (iface.find("wl") == 0) ? "wifi" : "ethernet";
+    if (config.daemon) return runDaemon(ifaces, config);
+
+    std::vector<ProbeResult> results;
+    LatencyStats no_latency = {0, -1.0, -1.0, 0.0};
+    for (const auto& iface : ifaces) {
+        results.push_back({iface, no_latency, 0.0, -1.0, "passive"});
+    }
+
+    if (!config.probe_url.empty()) curl_global_init(CURL_GLOBAL_ALL);
 
-        double latency = getLatency(iface);
-        double speed = getThroughput(iface);
+    // Downloads from the probe host already measured what its sample would;
+    // interfaces with a recent record skip the active probe
+    std::map<std::string, HostRecord> learned;
+    if (!config.probe_url.empty() && !config.history_path.empty()) {
+        learned = HostHistory(config.history_path).lookup(url_host(config.probe_url), kRecentHistorySeconds);
+    }
+
+    // Probe every interface at once so the scan takes one window, not one per NIC
+    std::vector<std::thread> probes;
+    for (auto& result : results) {
+        probes.push_back(std::thread([&result, &config, &learned]() {
+            result.latency = getLatency(result.iface, config);
+            auto known = learned.find(result.iface);
+            if (known != learned.end()) {
+                result.speed = known->second.goodput / 1024.0;
+                result.rtt = known->second.rtt > 0 ? known->second.rtt * 1000.0 : -1.0;
+                result.source = "history";
+                return;
+            }
+            if (!config.probe_url.empty()) {
+                ActiveProbe probe = getActiveThroughput(result.iface, config);
+                if (probe.ok) {
+                    result.speed = probe.goodput;
+                    result.rtt = probe.rtt;
+                    result.source = "active";
+                    return;
+                }
+                std::cerr << "Active probe failed on " << result.iface
+                          << ", falling back to passive measurement" << std::endl;
+            }
+            result.speed = getThroughput(result.iface, config);
+        }));
+    }
+    for (auto& probe : probes) {
+        probe.join();
+    }
+
+    for (const auto& result : results) {
+        double latency = result.latency.median;
+        double speed = result.speed;
 
         if (latency < -0.5 && speed < 0.01) {
-            std::cerr << "Skipping inactive/problematic interface: " << iface << std::endl;
+            std::cerr << "Skipping inactive/problematic interface: " << result.iface << std::endl;
             continue;
         }
 
+        Json::Value net;
+        net["interface"] = result.iface;
+        net["ssid"] = "";
+        net["type"] = (result.iface.find("wl") == 0) ? "wifi" : "ethernet";
         net["latency"] = latency;
+        net["latency_min"] = result.latency.min;
+        net["jitter"] = result.latency.jitter;
         net["speed"] = speed;
         net["signal_strength"] = -1; // placeholder
         net["quality"] = 0;          // placeholder
-        net["score"] = speed - latency;
+        net["rtt"] = result.rtt;
+        net["probe"] = result.source;
+        net["score"] = computeScore(speed, latency);
 
         root["networks"].append(net);
     }
 
-    std::ofstream file("networks.json");
-    if (!file) {
+    if (!saveNetworks(root)) {
         std::cerr << "Failed to open networks.json for writing!" << std::endl;
         return 1;
     }
-    file << root.toStyledString();
-    file.close();
 
     std::cout << "Network scan saved to networks.json" << std::endl;
     return 0;
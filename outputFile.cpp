@@ -0,0 +1,278 @@
+#include "outputFile.h"
+
+#include <algorithm>
+#include <iterator>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+// A writer appending at the stream's head waits while this much is already
+// lined up for the pipe; bytes further ahead are bounded by the scheduler
+const size_t kMaxStreamBacklog = 4 * 1024 * 1024;
+
+} // namespace
+
+OutputFile::OutputFile()
+    : fd(-1),
+      owns_fd(true),
+      stream(false),
+      head(0),
+      written(0),
+      buffered(0),
+      peak(0),
+      writing(false),
+      closing(false),
+      broken(false) {}
+
+OutputFile::~OutputFile() {
+    close();
+}
+
+bool OutputFile::open(const std::string& path, int64_t size, std::string& error) {
+    close();
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    owns_fd = true;
+    if (fd < 0) {
+        error = "Could not open " + path + ": " + strerror(errno);
+        return false;
+    }
+    if (size <= 0) return true;
+
+    // Reserve real blocks so a full disk fails now instead of mid-download
+    // and the extents stay contiguous; fall back to a sparse file where the
+    // filesystem cannot preallocate
+    if (fallocate(fd, 0, 0, size) == 0) return true;
+    if (errno == ENOSPC) {
+        error = "Not enough disk space for " + path + " (" + std::to_string(size) + " bytes)";
+        close();
+        return false;
+    }
+    if (ftruncate(fd, size) != 0) {
+        error = "Could not size " + path + ": " + strerror(errno);
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool OutputFile::reopen(const std::string& path, int64_t size, std::string& error) {
+    close();
+    fd = ::open(path.c_str(), O_RDWR);
+    owns_fd = true;
+    if (fd < 0) {
+        error = "Could not open " + path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != size) {
+        error = path + " does not match the partial download";
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool OutputFile::is_stream_path(const std::string& path) {
+    if (path == "-") return true;
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode));
+}
+
+bool OutputFile::open_stream(const std::string& path, std::string& error) {
+    close();
+    if (path == "-") {
+        fd = STDOUT_FILENO;
+        owns_fd = false;
+    } else {
+        fd = ::open(path.c_str(), O_WRONLY);
+        owns_fd = true;
+        if (fd < 0) {
+            error = "Could not open " + path + ": " + strerror(errno);
+            return false;
+        }
+    }
+    stream = true;
+    writer = std::thread(&OutputFile::write_loop, this);
+    return true;
+}
+
+void OutputFile::set_stream_callback(StreamCallback callback) {
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    stream_callback = callback;
+}
+
+bool OutputFile::finish_stream() {
+    std::unique_lock<std::mutex> lock(stream_mutex);
+    stream_changed.wait(lock, [this]() {
+        return broken || (!writing && (pending.empty() || pending.begin()->first > head));
+    });
+    return !broken;
+}
+
+int64_t OutputFile::streamed() const {
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    return written;
+}
+
+int64_t OutputFile::peak_buffered() const {
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    return peak;
+}
+
+bool OutputFile::stream_failed() const {
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    return broken;
+}
+
+bool OutputFile::write_at(const char* data, size_t len, int64_t offset) {
+    if (stream) return write_stream(data, len, offset);
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Hands the bytes at offset to the writer thread, joining the held block
+// they continue. Only a writer at the head of a long backlog waits, and
+// never while holding the lock: the reader's pace throttles it there.
+bool OutputFile::write_stream(const char* data, size_t len, int64_t offset) {
+    std::unique_lock<std::mutex> lock(stream_mutex);
+    stream_changed.wait(lock, [this, offset]() {
+        if (broken || closing || pending.empty()) return true;
+        auto front = pending.begin();
+        int64_t front_end = front->first + static_cast<int64_t>(front->second.size());
+        return front->first > head || offset > front_end || front->second.size() < kMaxStreamBacklog;
+    });
+    if (broken || closing) return false;
+    if (offset + static_cast<int64_t>(len) <= head) return true;
+    if (offset < head) {
+        data += head - offset;
+        len -= head - offset;
+        offset = head;
+    }
+
+    auto it = pending.upper_bound(offset);
+    if (it != pending.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + static_cast<int64_t>(prev->second.size()) == offset) {
+            prev->second.append(data, len);
+            buffered += len;
+            peak = std::max(peak, buffered);
+            stream_changed.notify_all();
+            return true;
+        }
+    }
+    // A block fetched twice keeps its longer copy
+    std::string& block = pending[offset];
+    if (block.size() < len) {
+        buffered += static_cast<int64_t>(len - block.size());
+        block.assign(data, len);
+    }
+    peak = std::max(peak, buffered);
+    stream_changed.notify_all();
+    return true;
+}
+
+// Takes the block at the head whenever there is one and writes it out
+// without the lock, so writers keep adding blocks meanwhile
+void OutputFile::write_loop() {
+    std::unique_lock<std::mutex> lock(stream_mutex);
+    while (true) {
+        stream_changed.wait(lock, [this]() {
+            return closing || (!pending.empty() && pending.begin()->first <= head);
+        });
+        if (closing) break;
+
+        auto it = pending.begin();
+        std::string block;
+        block.swap(it->second);
+        int64_t skip = head - it->first;
+        pending.erase(it);
+        buffered -= static_cast<int64_t>(block.size());
+        int64_t size = static_cast<int64_t>(block.size());
+        if (skip >= size) {
+            stream_changed.notify_all();
+            continue;
+        }
+        head += size - skip;
+        writing = true;
+        stream_changed.notify_all();
+        lock.unlock();
+
+        const char* data = block.data() + skip;
+        size_t len = static_cast<size_t>(size - skip);
+        if (stream_callback) stream_callback(data, len);
+        bool ok = true;
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                ok = false;
+                break;
+            }
+            data += n;
+            len -= n;
+        }
+
+        lock.lock();
+        writing = false;
+        written += size - skip - static_cast<int64_t>(len);
+        if (!ok) broken = true;
+        stream_changed.notify_all();
+        if (!ok) break;
+    }
+}
+
+bool OutputFile::read_at(char* data, size_t len, int64_t offset) {
+    if (stream) return false;
+    while (len > 0) {
+        ssize_t n = pread(fd, data, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) return false;
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool OutputFile::sync() {
+    // A pipe has nothing to flush
+    return fd >= 0 && (stream || fdatasync(fd) == 0);
+}
+
+void OutputFile::close() {
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(stream_mutex);
+            closing = true;
+        }
+        stream_changed.notify_all();
+        writer.join();
+    }
+    if (fd >= 0 && owns_fd) ::close(fd);
+    fd = -1;
+    stream = false;
+    head = 0;
+    written = 0;
+    pending.clear();
+    buffered = 0;
+    peak = 0;
+    writing = false;
+    closing = false;
+    broken = false;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <cstdint>
+
+// Destination file for a download. Space for the whole body is reserved up
+// front and every transfer writes its bytes at their final offset, so chunks
+// can arrive in any order without temporary part files or a merge step.
+// Opened as a stream instead, bytes leave in file order through a pipe and
+// chunks that arrive early wait in memory until the gap before them closes.
+// A writer thread of its own feeds the pipe, so the reader's pace never
+// holds up the threads that hand it bytes.
+class OutputFile {
+public:
+    // Receives every byte of a stream in order, as it is written out
+    typedef std::function<void(const char*, size_t)> StreamCallback;
+
+    OutputFile();
+    ~OutputFile();
+
+    // Opens and truncates path; size >= 0 preallocates the full length
+    bool open(const std::string& path, int64_t size, std::string& error);
+
+    // Opens a partial download for resuming; it must already be size bytes
+    bool reopen(const std::string& path, int64_t size, std::string& error);
+
+    // Writes to stdout ("-") or an existing pipe or device in file order
+    bool open_stream(const std::string& path, std::string& error);
+
+    // Outputs open_stream() takes: "-", FIFOs and character devices
+    static bool is_stream_path(const std::string& path);
+
+    bool streaming() const { return stream; }
+    void set_stream_callback(StreamCallback callback);
+
+    // Stream only: waits until the writer has written out every byte it can
+    // (up to the first gap); false if the reader went away
+    bool finish_stream();
+
+    // Stream only: bytes written out so far, the most ever held back in
+    // memory, and whether the reader went away
+    int64_t streamed() const;
+    int64_t peak_buffered() const;
+    bool stream_failed() const;
+
+    // Thread-safe: concurrent writers only ever touch disjoint ranges
+    bool write_at(const char* data, size_t len, int64_t offset);
+
+    // Reads back written bytes; false on error, end of file or a stream
+    bool read_at(char* data, size_t len, int64_t offset);
+
+    // Flush written data to disk before the journal claims it is there
+    bool sync();
+
+    void close();
+    bool is_open() const { return fd >= 0; }
+
+    // For writes submitted through io_uring
+    int descriptor() const { return fd; }
+
+private:
+    int fd;
+    bool owns_fd;
+    bool stream;
+    mutable std::mutex stream_mutex;
+    std::condition_variable stream_changed;
+    std::thread writer;
+    int64_t head;       // next offset the writer takes
+    int64_t written;    // bytes the writer has written out
+    std::map<int64_t, std::string> pending;
+    int64_t buffered;
+    int64_t peak;
+    bool writing;       // the writer is outside the lock with a block
+    bool closing;
+    bool broken;
+    StreamCallback stream_callback;
+
+    bool write_stream(const char* data, size_t len, int64_t offset);
+    void write_loop();
+
+    OutputFile(const OutputFile&);
+    OutputFile& operator=(const OutputFile&);
+};
@@ -0,0 +1,408 @@
+#include "routingManager.h"
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/fib_rules.h>
+#include <functional>
+#include "interfaceInfo.h"
+
+namespace {
+
+// Tables 0x6d757300 + ifindex ("mus" + index) are ours; no distribution
+// uses that range, so stale entries can be told apart from the admin's
+const uint32_t kTableBase = 0x6d757300;
+const uint32_t kTableSpan = 0x100;
+// All our rules share one priority, ahead of the main table (32766)
+const uint32_t kRulePriority = 10900;
+
+uint32_t table_for(int ifindex) {
+    return kTableBase + static_cast<uint32_t>(ifindex) % kTableSpan;
+}
+
+bool is_our_table(uint32_t table) {
+    return table >= kTableBase && table < kTableBase + kTableSpan;
+}
+
+// Processes sharing a table each hold a flock on their own marker file
+// "<table>.<pid>" here; the kernel drops the lock when its owner dies, so a
+// marker nobody holds belongs to a crashed process
+const char* const kOwnerDirectory = "/run/mush/routes";
+
+std::string marker_prefix(uint32_t table) {
+    return std::to_string(table) + ".";
+}
+
+bool make_owner_directory() {
+    if (mkdir("/run/mush", 0755) != 0 && errno != EEXIST) return false;
+    return mkdir(kOwnerDirectory, 0755) == 0 || errno == EEXIST;
+}
+
+// Serialises installs and removals between processes for its lifetime
+class OwnerLock {
+public:
+    OwnerLock() : fd(-1) {
+        if (!make_owner_directory()) return;
+        fd = open((std::string(kOwnerDirectory) + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    ~OwnerLock() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool ok() const { return fd >= 0; }
+
+private:
+    int fd;
+};
+
+// Marks this process as a user of table; -1 when markers are unavailable
+int claim_table(uint32_t table) {
+    std::string path = std::string(kOwnerDirectory) + "/" + marker_prefix(table) + std::to_string(getpid());
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+void release_table(uint32_t table, int marker) {
+    if (marker < 0) return;
+    unlink((std::string(kOwnerDirectory) + "/" + marker_prefix(table) + std::to_string(getpid())).c_str());
+    close(marker);
+}
+
+// True when another live process still uses table; markers of dead ones are
+// removed on the way
+bool used_elsewhere(uint32_t table) {
+    DIR* dir = opendir(kOwnerDirectory);
+    if (!dir) return false;
+    std::string prefix = marker_prefix(table);
+    std::string own = prefix + std::to_string(getpid());
+    bool used = false;
+    while (struct dirent* item = readdir(dir)) {
+        std::string name = item->d_name;
+        if (name.compare(0, prefix.size(), prefix) != 0 || name == own) continue;
+        std::string path = std::string(kOwnerDirectory) + "/" + name;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            unlink(path.c_str());
+        } else {
+            used = true;
+        }
+        close(fd);
+    }
+    closedir(dir);
+    return used;
+}
+
+// Request buffer: header, family-specific struct and attributes
+struct NetlinkRequest {
+    struct nlmsghdr header;
+    char payload[512];
+};
+
+void add_attr(NetlinkRequest& req, unsigned short type, const void* data, size_t len) {
+    struct rtattr* rta = reinterpret_cast<struct rtattr*>(
+        reinterpret_cast<char*>(&req) + NLMSG_ALIGN(req.header.nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    req.header.nlmsg_len = NLMSG_ALIGN(req.header.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+template <typename T>
+T* init_request(NetlinkRequest& req, uint16_t type, uint16_t flags) {
+    memset(&req, 0, sizeof(req));
+    req.header.nlmsg_len = NLMSG_LENGTH(sizeof(T));
+    req.header.nlmsg_type = type;
+    req.header.nlmsg_flags = NLM_F_REQUEST | flags;
+    return static_cast<T*>(NLMSG_DATA(&req.header));
+}
+
+// Thin rtnetlink socket: one request at a time, acked or dumped
+class Netlink {
+public:
+    Netlink() : fd(socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)), seq(0) {}
+    ~Netlink() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool ok() const { return fd >= 0; }
+
+    // Returns 0 on success or the kernel's (positive) errno
+    int request(NetlinkRequest& req) {
+        req.header.nlmsg_flags |= NLM_F_ACK;
+        int result = EIO;
+        transact(req, [&result](const struct nlmsghdr* msg) {
+            if (msg->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr* err = static_cast<const struct nlmsgerr*>(NLMSG_DATA(msg));
+                result = -err->error;
+            }
+        });
+        return result;
+    }
+
+    // Calls on_message for every message of a NLM_F_DUMP reply
+    bool dump(NetlinkRequest& req, const std::function<void(const struct nlmsghdr*)>& on_message) {
+        req.header.nlmsg_flags |= NLM_F_DUMP;
+        return transact(req, on_message);
+    }
+
+private:
+    int fd;
+    uint32_t seq;
+
+    bool transact(NetlinkRequest& req, const std::function<void(const struct nlmsghdr*)>& on_message) {
+        req.header.nlmsg_seq = ++seq;
+        struct sockaddr_nl kernel;
+        memset(&kernel, 0, sizeof(kernel));
+        kernel.nl_family = AF_NETLINK;
+        if (sendto(fd, &req, req.header.nlmsg_len, 0,
+                   reinterpret_cast<struct sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+            return false;
+        }
+
+        char buffer[16384];
+        while (true) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            int len = static_cast<int>(n);
+            for (struct nlmsghdr* msg = reinterpret_cast<struct nlmsghdr*>(buffer);
+                 NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+                if (msg->nlmsg_seq != req.header.nlmsg_seq) continue;
+                if (msg->nlmsg_type == NLMSG_DONE) return true;
+                on_message(msg);
+                // An ack (or error) ends a non-dump request
+                if (msg->nlmsg_type == NLMSG_ERROR) return true;
+            }
+        }
+    }
+};
+
+uint32_t route_table(const struct rtmsg* rtm, const struct nlmsghdr* msg) {
+    uint32_t table = rtm->rtm_table;
+    int len = RTM_PAYLOAD(msg);
+    for (struct rtattr* rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == RTA_TABLE) table = *static_cast<uint32_t*>(RTA_DATA(rta));
+    }
+    return table;
+}
+
+// Default gateway of ifindex in the main table, 0 when there is none
+uint32_t find_gateway(Netlink& nl, int ifindex) {
+    NetlinkRequest req;
+    struct rtmsg* rtm = init_request<struct rtmsg>(req, RTM_GETROUTE, 0);
+    rtm->rtm_family = AF_INET;
+
+    uint32_t gateway = 0;
+    nl.dump(req, [&](const struct nlmsghdr* msg) {
+        if (msg->nlmsg_type != RTM_NEWROUTE || gateway) return;
+        const struct rtmsg* route = static_cast<const struct rtmsg*>(NLMSG_DATA(msg));
+        if (route->rtm_dst_len != 0 || route_table(route, msg) != RT_TABLE_MAIN) return;
+
+        int oif = 0;
+        uint32_t gw = 0;
+        int len = RTM_PAYLOAD(msg);
+        for (struct rtattr* rta = RTM_RTA(route); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == RTA_OIF) oif = *static_cast<int*>(RTA_DATA(rta));
+            if (rta->rta_type == RTA_GATEWAY) gw = *static_cast<uint32_t*>(RTA_DATA(rta));
+        }
+        if (oif == ifindex && gw) gateway = gw;
+    });
+    return gateway;
+}
+
+int set_link_up(Netlink& nl, int ifindex) {
+    NetlinkRequest req;
+    struct ifinfomsg* ifi = init_request<struct ifinfomsg>(req, RTM_NEWLINK, 0);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+    ifi->ifi_flags = IFF_UP;
+    ifi->ifi_change = IFF_UP;
+    return nl.request(req);
+}
+
+int change_route(Netlink& nl, uint16_t type, uint16_t flags, uint32_t table, int ifindex,
+                 uint32_t gateway) {
+    NetlinkRequest req;
+    struct rtmsg* rtm = init_request<struct rtmsg>(req, type, flags);
+    rtm->rtm_family = AF_INET;
+    rtm->rtm_table = RT_TABLE_UNSPEC;
+    rtm->rtm_protocol = RTPROT_STATIC;
+    rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+    rtm->rtm_type = RTN_UNICAST;
+    add_attr(req, RTA_TABLE, &table, sizeof(table));
+    add_attr(req, RTA_OIF, &ifindex, sizeof(ifindex));
+    if (gateway) add_attr(req, RTA_GATEWAY, &gateway, sizeof(gateway));
+    return nl.request(req);
+}
+
+int change_rule(Netlink& nl, uint16_t type, uint16_t flags, uint32_t table, uint32_t source) {
+    NetlinkRequest req;
+    struct fib_rule_hdr* rule = init_request<struct fib_rule_hdr>(req, type, flags);
+    rule->family = AF_INET;
+    rule->action = FR_ACT_TO_TBL;
+    rule->src_len = source ? 32 : 0;
+    uint32_t priority = kRulePriority;
+    add_attr(req, FRA_TABLE, &table, sizeof(table));
+    add_attr(req, FRA_PRIORITY, &priority, sizeof(priority));
+    if (source) add_attr(req, FRA_SRC, &source, sizeof(source));
+    return nl.request(req);
+}
+
+} // namespace
+
+RoutingManager& RoutingManager::instance() {
+    static RoutingManager manager;
+    return manager;
+}
+
+RoutingManager::RoutingManager() {
+    if (geteuid() == 0) purge_stale();
+}
+
+RoutingManager::~RoutingManager() {
+    cleanup();
+}
+
+bool RoutingManager::ensure(const std::string& iface, std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (installed.count(iface)) return true;
+
+    Netlink nl;
+    if (!nl.ok()) {
+        error = std::string("netlink socket: ") + strerror(errno);
+        return false;
+    }
+    int ifindex = static_cast<int>(if_nametoindex(iface.c_str()));
+    if (ifindex == 0) {
+        error = "no such interface";
+        return false;
+    }
+
+    int rc = set_link_up(nl, ifindex);
+    if (rc != 0) {
+        error = std::string("could not bring link up: ") + strerror(rc);
+        return false;
+    }
+
+    std::string ip = interface_ipv4(iface);
+    uint32_t source = 0;
+    if (ip.empty() || inet_pton(AF_INET, ip.c_str(), &source) != 1) {
+        error = "no IPv4 address";
+        return false;
+    }
+    uint32_t gateway = find_gateway(nl, ifindex);
+    if (!gateway) {
+        error = "no default gateway in the main table";
+        return false;
+    }
+
+    // Claim the table before touching it, so a process tearing its own
+    // entries down concurrently leaves them in place
+    OwnerLock owners;
+    Entry entry = {ifindex, table_for(ifindex), source, gateway, owners.ok() ? claim_table(table_for(ifindex)) : -1};
+    rc = change_route(nl, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, entry.table, ifindex, gateway);
+    if (rc != 0) {
+        release_table(entry.table, entry.marker);
+        error = std::string("could not add route: ") + strerror(rc);
+        return false;
+    }
+    rc = change_rule(nl, RTM_NEWRULE, NLM_F_CREATE | NLM_F_EXCL, entry.table, source);
+    if (rc != 0 && rc != EEXIST) {
+        release_table(entry.table, entry.marker);
+        if (!used_elsewhere(entry.table)) change_route(nl, RTM_DELROUTE, 0, entry.table, ifindex, gateway);
+        error = std::string("could not add rule: ") + strerror(rc);
+        return false;
+    }
+
+    installed[iface] = entry;
+    return true;
+}
+
+void RoutingManager::cleanup() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (installed.empty()) return;
+
+    Netlink nl;
+    OwnerLock owners;
+    for (const auto& item : installed) {
+        const Entry& e = item.second;
+        release_table(e.table, e.marker);
+        // Another downloader routing through the same interface keeps them
+        if (!nl.ok() || (owners.ok() && used_elsewhere(e.table))) continue;
+        change_rule(nl, RTM_DELRULE, 0, e.table, e.source);
+        change_route(nl, RTM_DELROUTE, 0, e.table, e.ifindex, e.gateway);
+    }
+    installed.clear();
+}
+
+void RoutingManager::purge_stale() {
+    Netlink nl;
+    // Without markers a live owner cannot be told from a crashed one
+    OwnerLock owners;
+    if (!nl.ok() || !owners.ok()) return;
+
+    // Collect first; the dump must finish before issuing deletes
+    std::vector<std::pair<uint32_t, uint32_t>> rules; // table, source
+    NetlinkRequest req;
+    struct fib_rule_hdr* hdr = init_request<struct fib_rule_hdr>(req, RTM_GETRULE, 0);
+    hdr->family = AF_INET;
+    nl.dump(req, [&rules](const struct nlmsghdr* msg) {
+        if (msg->nlmsg_type != RTM_NEWRULE) return;
+        const struct fib_rule_hdr* rule = static_cast<const struct fib_rule_hdr*>(NLMSG_DATA(msg));
+        uint32_t table = rule->table, priority = 0, source = 0;
+        int len = static_cast<int>(msg->nlmsg_len - NLMSG_LENGTH(sizeof(*rule)));
+        const struct rtattr* rta = reinterpret_cast<const struct rtattr*>(
+            reinterpret_cast<const char*>(rule) + NLMSG_ALIGN(sizeof(*rule)));
+        for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == FRA_TABLE) table = *static_cast<const uint32_t*>(RTA_DATA(rta));
+            if (rta->rta_type == FRA_PRIORITY) priority = *static_cast<const uint32_t*>(RTA_DATA(rta));
+            if (rta->rta_type == FRA_SRC) source = *static_cast<const uint32_t*>(RTA_DATA(rta));
+        }
+        if (priority == kRulePriority && is_our_table(table) && !used_elsewhere(table)) {
+            rules.push_back(std::make_pair(table, source));
+        }
+    });
+
+    std::vector<std::pair<uint32_t, int>> routes; // table, oif
+    struct rtmsg* rtm = init_request<struct rtmsg>(req, RTM_GETROUTE, 0);
+    rtm->rtm_family = AF_INET;
+    nl.dump(req, [&routes](const struct nlmsghdr* msg) {
+        if (msg->nlmsg_type != RTM_NEWROUTE) return;
+        const struct rtmsg* route = static_cast<const struct rtmsg*>(NLMSG_DATA(msg));
+        uint32_t table = route_table(route, msg);
+        if (!is_our_table(table) || used_elsewhere(table)) return;
+        int oif = 0;
+        int len = RTM_PAYLOAD(msg);
+        for (struct rtattr* rta = RTM_RTA(route); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == RTA_OIF) oif = *static_cast<int*>(RTA_DATA(rta));
+        }
+        routes.push_back(std::make_pair(table, oif));
+    });
+
+    for (const auto& rule : rules) {
+        change_rule(nl, RTM_DELRULE, 0, rule.first, rule.second);
+    }
+    for (const auto& route : routes) {
+        change_route(nl, RTM_DELROUTE, 0, route.first, route.second, 0);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+// Per-interface policy routing over rtnetlink, replacing the `ip rule` /
+// `ip route` commands the download script used to run. Each interface gets
+// its own table holding a default route via its gateway, plus a rule sending
+// traffic sourced from its address to that table. Entries are installed once
+// and reused by every later download in the process. Several processes may
+// share an interface's entries: each marks itself as a user, the last one
+// to exit removes them, and any whose users have all crashed are purged on
+// startup.
+class RoutingManager {
+public:
+    static RoutingManager& instance();
+
+    // Install (or confirm) the table and rule for iface, bringing the link up
+    // first if needed. Requires CAP_NET_ADMIN.
+    bool ensure(const std::string& iface, std::string& error);
+
+    // Give up this process's entries, removing those no other process uses
+    void cleanup();
+
+private:
+    // What was installed for one interface, needed to delete it again
+    struct Entry {
+        int ifindex;
+        uint32_t table;
+        uint32_t source;   // network byte order
+        uint32_t gateway;  // network byte order
+        int marker;        // locked owner marker, -1 when unavailable
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Entry> installed;
+
+    RoutingManager();
+    ~RoutingManager();
+    RoutingManager(const RoutingManager&);
+    RoutingManager& operator=(const RoutingManager&);
+
+    void purge_stale();
+};
@@ -0,0 +1,156 @@
+#include "streamVerifier.h"
+
+#include <algorithm>
+#include <zlib.h>
+
+namespace {
+
+// Read-back block; chunks are hashed in pieces of this size
+const size_t kReadBlockSize = 1024 * 1024;
+
+} // namespace
+
+Sha256::Sha256() : ctx(EVP_MD_CTX_new()) {
+    EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+}
+
+Sha256::~Sha256() {
+    EVP_MD_CTX_free(ctx);
+}
+
+Sha256::Sha256(const Sha256& other) : ctx(EVP_MD_CTX_new()) {
+    EVP_MD_CTX_copy_ex(ctx, other.ctx);
+}
+
+Sha256& Sha256::operator=(const Sha256& other) {
+    if (this != &other) EVP_MD_CTX_copy_ex(ctx, other.ctx);
+    return *this;
+}
+
+void Sha256::update(const void* data, size_t len) {
+    EVP_DigestUpdate(ctx, data, len);
+}
+
+std::string Sha256::hex_digest() const {
+    // Finalizing consumes the context, so finish a copy
+    Sha256 copy(*this);
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    EVP_DigestFinal_ex(copy.ctx, md, &len);
+
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned int i = 0; i < len; i++) {
+        hex += digits[md[i] >> 4];
+        hex += digits[md[i] & 0xf];
+    }
+    return hex;
+}
+
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len) {
+    const Bytef* bytes = static_cast<const Bytef*>(data);
+    while (len > 0) {
+        uInt n = len > 0x40000000 ? 0x40000000 : static_cast<uInt>(len);
+        crc = static_cast<uint32_t>(crc32(crc, bytes, n));
+        bytes += n;
+        len -= n;
+    }
+    return crc;
+}
+
+StreamVerifier::StreamVerifier(OutputFile& file, int64_t size)
+    : file(file), total(size), hashed(0), working(false), stopping(false) {
+    worker = std::thread(&StreamVerifier::run, this);
+}
+
+StreamVerifier::~StreamVerifier() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void StreamVerifier::add(const ByteRange& range, uint32_t crc, size_t lane) {
+    if (range.length() <= 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending[range.start] = {range.end, crc, true, lane};
+    }
+    wake.notify_all();
+}
+
+void StreamVerifier::add_existing(const ByteRange& range) {
+    if (range.length() <= 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending[range.start] = {range.end, 0, false, kNoLane};
+    }
+    wake.notify_all();
+}
+
+std::vector<ChunkMismatch> StreamVerifier::take_mismatches() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ChunkMismatch> taken;
+    taken.swap(mismatches);
+    return taken;
+}
+
+bool StreamVerifier::busy() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return working || pending.count(hashed) > 0;
+}
+
+int64_t StreamVerifier::verified() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hashed;
+}
+
+std::string StreamVerifier::sha256() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return digest.hex_digest();
+}
+
+void StreamVerifier::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return stopping || pending.count(hashed) > 0; });
+        if (stopping) return;
+
+        auto it = pending.find(hashed);
+        int64_t start = it->first;
+        Pending chunk = it->second;
+        pending.erase(it);
+        Sha256 hash = digest;
+        working = true;
+
+        // The download keeps adding chunks while this one is read back
+        lock.unlock();
+        bool ok = check(start, chunk, hash);
+        lock.lock();
+
+        working = false;
+        if (ok) {
+            digest = hash;
+            hashed = chunk.end + 1;
+        } else {
+            mismatches.push_back({{start, chunk.end}, chunk.lane});
+        }
+    }
+}
+
+// Hashes [start, chunk.end] into hash and compares its CRC32 with the one
+// taken on arrival; a failed read counts as a mismatch so it is fetched again
+bool StreamVerifier::check(int64_t start, const Pending& chunk, Sha256& hash) {
+    std::vector<char> block(kReadBlockSize);
+    uint32_t crc = 0;
+    for (int64_t offset = start; offset <= chunk.end; ) {
+        size_t len = static_cast<size_t>(std::min<int64_t>(block.size(), chunk.end + 1 - offset));
+        if (!file.read_at(block.data(), len, offset)) return false;
+        hash.update(block.data(), len);
+        if (chunk.has_crc) crc = crc32_update(crc, block.data(), len);
+        offset += len;
+    }
+    return !chunk.has_crc || crc == chunk.crc;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdint>
+#include <openssl/evp.h>
+#include "chunkScheduler.h"
+#include "outputFile.h"
+
+// Incremental SHA-256; a copy snapshots the running state
+class Sha256 {
+public:
+    Sha256();
+    ~Sha256();
+    Sha256(const Sha256& other);
+    Sha256& operator=(const Sha256& other);
+
+    void update(const void* data, size_t len);
+
+    // Lowercase hex of everything hashed so far; hashing may continue
+    std::string hex_digest() const;
+
+private:
+    EVP_MD_CTX* ctx;
+};
+
+// CRC32 of len more bytes, continuing from crc (0 to start)
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len);
+
+// A chunk whose bytes on disk differ from the bytes that arrived
+struct ChunkMismatch {
+    ByteRange range;
+    size_t lane;
+};
+
+// Hashes the output file front to back while the download is still running.
+// Chunks land in any order; each one is read back (still in the page cache)
+// as soon as everything before it is on disk, checked against the CRC32
+// taken while it arrived and fed to a running SHA-256. The whole file is
+// never read a second time once the download ends.
+class StreamVerifier {
+public:
+    StreamVerifier(OutputFile& file, int64_t size);
+    ~StreamVerifier();
+
+    // Bytes received in this run, with their CRC32 and the lane that got them
+    void add(const ByteRange& range, uint32_t crc, size_t lane);
+
+    // Bytes kept from an earlier run: hashed, but there is no CRC to check
+    void add_existing(const ByteRange& range);
+
+    // Chunks that failed the check since the last call. They are forgotten:
+    // hashing waits at the first one until it is fetched and added again.
+    std::vector<ChunkMismatch> take_mismatches();
+
+    // True while bytes that were added are still waiting to be hashed
+    bool busy() const;
+
+    // Bytes hashed from the start of the file
+    int64_t verified() const;
+
+    bool finished() const { return verified() >= total; }
+
+    // Digest of the whole file; only meaningful once finished()
+    std::string sha256() const;
+
+private:
+    struct Pending {
+        int64_t end;
+        uint32_t crc;
+        bool has_crc;
+        size_t lane;
+    };
+
+    OutputFile& file;
+    int64_t total;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::map<int64_t, Pending> pending;
+    std::vector<ChunkMismatch> mismatches;
+    int64_t hashed;
+    bool working;
+    bool stopping;
+    Sha256 digest;
+    std::thread worker;
+
+    StreamVerifier(const StreamVerifier&);
+    StreamVerifier& operator=(const StreamVerifier&);
+
+    void run();
+    bool check(int64_t start, const Pending& chunk, Sha256& hash);
+};
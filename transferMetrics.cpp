@@ -0,0 +1,232 @@
+#include "transferMetrics.h"
+
+#include <sstream>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <json/json.h>
+
+namespace {
+
+const char* const kPhaseNames[] = {"dns", "connect", "tls", "ttfb", "transfer"};
+
+// Histogram bounds in seconds: sub-millisecond cache hits up to a minute
+const double kBucketBounds[] = {0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+const size_t kBucketCount = sizeof(kBucketBounds) / sizeof(kBucketBounds[0]);
+
+// How long a scraper may take to send its request
+const int kRequestTimeoutMs = 1000;
+
+std::string label(const std::string& value) {
+    std::string out;
+    for (char c : value) {
+        if (c == '\\' || c == '"') out += '\\';
+        if (c == '\n') {
+            out += "\\n";
+            continue;
+        }
+        out += c;
+    }
+    return out;
+}
+
+} // namespace
+
+TransferMetrics::TransferMetrics() {}
+
+bool TransferMetrics::open_trace(const std::string& path, std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex);
+    trace.open(path, std::ios::app);
+    if (!trace.is_open()) {
+        error = "Could not open " + path + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void TransferMetrics::new_download() {
+    std::lock_guard<std::mutex> lock(mutex);
+    failed_ends.clear();
+}
+
+void TransferMetrics::record(ChunkTiming timing) {
+    std::lock_guard<std::mutex> lock(mutex);
+    timing.attempt = failed_ends[timing.range.end] + 1;
+    if (timing.result == "ok") {
+        failed_ends.erase(timing.range.end);
+    } else {
+        failed_ends[timing.range.end]++;
+    }
+
+    InterfaceStats& stats = interfaces[timing.interface];
+    stats.chunks[timing.result]++;
+    stats.bytes += timing.bytes;
+    if (timing.attempt > 1) stats.retries++;
+    if (!timing.reused) stats.connections++;
+    const double phases[kPhases] = {timing.dns, timing.connect, timing.tls, timing.ttfb, timing.transfer};
+    for (size_t p = 0; p < kPhases; p++) {
+        Histogram& histogram = stats.phases[p];
+        histogram.buckets.resize(kBucketCount);
+        for (size_t b = 0; b < kBucketCount; b++) {
+            if (phases[p] <= kBucketBounds[b]) histogram.buckets[b]++;
+        }
+        histogram.sum += phases[p];
+        histogram.count++;
+    }
+
+    if (!trace.is_open()) return;
+    Json::Value line;
+    line["time"] = std::chrono::duration<double>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    line["interface"] = timing.interface;
+    line["mirror"] = timing.mirror;
+    line["start"] = Json::Int64(timing.range.start);
+    line["end"] = Json::Int64(timing.range.end);
+    line["bytes"] = Json::Int64(timing.bytes);
+    line["attempt"] = timing.attempt;
+    line["result"] = timing.result;
+    if (!timing.error.empty()) line["error"] = timing.error;
+    line["protocol"] = timing.protocol;
+    line["reused"] = timing.reused;
+    for (size_t p = 0; p < kPhases; p++) {
+        line[kPhaseNames[p]] = phases[p];
+    }
+    line["total"] = timing.total;
+    Json::FastWriter writer;
+    trace << writer.write(line) << std::flush;
+}
+
+std::string TransferMetrics::prometheus_text() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream out;
+
+    out << "# HELP mush_chunks_total Range requests by interface and result\n"
+        << "# TYPE mush_chunks_total counter\n";
+    for (const auto& entry : interfaces) {
+        for (const auto& result : entry.second.chunks) {
+            out << "mush_chunks_total{interface=\"" << label(entry.first) << "\",result=\""
+                << result.first << "\"} " << result.second << "\n";
+        }
+    }
+    out << "# HELP mush_chunk_bytes_total Bytes written by range requests\n"
+        << "# TYPE mush_chunk_bytes_total counter\n";
+    for (const auto& entry : interfaces) {
+        out << "mush_chunk_bytes_total{interface=\"" << label(entry.first) << "\"} "
+            << entry.second.bytes << "\n";
+    }
+    out << "# HELP mush_chunk_retries_total Range requests that retried bytes an earlier one failed\n"
+        << "# TYPE mush_chunk_retries_total counter\n";
+    for (const auto& entry : interfaces) {
+        out << "mush_chunk_retries_total{interface=\"" << label(entry.first) << "\"} "
+            << entry.second.retries << "\n";
+    }
+    out << "# HELP mush_connections_total Range requests that opened a new connection\n"
+        << "# TYPE mush_connections_total counter\n";
+    for (const auto& entry : interfaces) {
+        out << "mush_connections_total{interface=\"" << label(entry.first) << "\"} "
+            << entry.second.connections << "\n";
+    }
+
+    out << "# HELP mush_chunk_phase_seconds Time range requests spent in each phase\n"
+        << "# TYPE mush_chunk_phase_seconds histogram\n";
+    for (const auto& entry : interfaces) {
+        for (size_t p = 0; p < kPhases; p++) {
+            const Histogram& histogram = entry.second.phases[p];
+            std::string labels = "interface=\"" + label(entry.first) + "\",phase=\"" + kPhaseNames[p] + "\"";
+            for (size_t b = 0; b < kBucketCount; b++) {
+                out << "mush_chunk_phase_seconds_bucket{" << labels << ",le=\"" << kBucketBounds[b]
+                    << "\"} " << histogram.buckets[b] << "\n";
+            }
+            out << "mush_chunk_phase_seconds_bucket{" << labels << ",le=\"+Inf\"} " << histogram.count << "\n"
+                << "mush_chunk_phase_seconds_sum{" << labels << "} " << histogram.sum << "\n"
+                << "mush_chunk_phase_seconds_count{" << labels << "} " << histogram.count << "\n";
+        }
+    }
+    return out.str();
+}
+
+MetricsEndpoint::MetricsEndpoint() : fd(-1), running(false) {}
+
+MetricsEndpoint::~MetricsEndpoint() {
+    stop();
+}
+
+bool MetricsEndpoint::start(int port, Render r, std::string& error) {
+    stop();
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+        || listen(fd, 16) != 0) {
+        error = "Could not listen on 127.0.0.1:" + std::to_string(port) + ": " + strerror(errno);
+        if (fd >= 0) close(fd);
+        fd = -1;
+        return false;
+    }
+
+    render = r;
+    running = true;
+    server = std::thread(&MetricsEndpoint::serve_loop, this);
+    return true;
+}
+
+void MetricsEndpoint::stop() {
+    running = false;
+    if (server.joinable()) server.join();
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+void MetricsEndpoint::serve_loop() {
+    while (running) {
+        // Wake up regularly so stop() never waits on an idle socket
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) continue;
+
+        // One request per connection; only the request line matters
+        std::string request;
+        char buffer[1024];
+        struct pollfd cfd = {client, POLLIN, 0};
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192
+               && poll(&cfd, 1, kRequestTimeoutMs) > 0) {
+            ssize_t n = read(client, buffer, sizeof(buffer));
+            if (n <= 0) break;
+            request.append(buffer, n);
+        }
+
+        std::string path = request.substr(0, request.find("\r\n"));
+        bool found = path.compare(0, 13, "GET /metrics ") == 0 || path.compare(0, 6, "GET / ") == 0;
+        std::string body = found ? render() : "Not found\n";
+        std::ostringstream response;
+        response << "HTTP/1.1 " << (found ? "200 OK" : "404 Not Found") << "\r\n"
+                 << "Content-Type: text/plain; version=0.0.4\r\n"
+                 << "Content-Length: " << body.size() << "\r\n"
+                 << "Connection: close\r\n\r\n" << body;
+        std::string text = response.str();
+        const char* data = text.data();
+        size_t left = text.size();
+        while (left > 0) {
+            ssize_t n = send(client, data, left, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            data += n;
+            left -= n;
+        }
+        close(client);
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <cstdint>
+#include "chunkScheduler.h"
+
+// One range request as libcurl timed it. Phases are in seconds and do not
+// overlap: DNS, TCP connect, TLS handshake, waiting for the first byte
+// after the request went out, and receiving the body. A request on a
+// reused connection has no DNS, connect or TLS time.
+struct ChunkTiming {
+    std::string interface;
+    std::string mirror;     // host[:port]
+    ByteRange range;        // as requested
+    int64_t bytes;          // written to the output
+    int attempt;            // filled in by TransferMetrics::record
+    bool reused;            // no new connection was opened
+    std::string protocol;   // e.g. "HTTP/2"
+    std::string result;     // "ok", "failed" or "cancelled"
+    std::string error;
+    double dns;
+    double connect;
+    double tls;
+    double ttfb;
+    double transfer;
+    double total;
+};
+
+// Collects a ChunkTiming for every range request: appended to a JSON-lines
+// trace file when one is open, and folded into per-interface counters and
+// phase histograms rendered in the Prometheus text format. Thread-safe.
+class TransferMetrics {
+public:
+    TransferMetrics();
+
+    // Appends one JSON object per request to path
+    bool open_trace(const std::string& path, std::string& error);
+
+    // Attempts are counted per download: a retried range keeps its end
+    // byte, so requests ending on the same byte are attempts of one chunk
+    void new_download();
+
+    void record(ChunkTiming timing);
+
+    // Counters and histograms since the metrics were created
+    std::string prometheus_text() const;
+
+private:
+    static const size_t kPhases = 5;
+
+    struct Histogram {
+        std::vector<uint64_t> buckets;  // cumulative counts per bound
+        double sum;
+        uint64_t count;
+
+        Histogram() : sum(0), count(0) {}
+    };
+
+    struct InterfaceStats {
+        std::map<std::string, uint64_t> chunks;     // by result
+        uint64_t bytes;
+        uint64_t retries;
+        uint64_t connections;
+        Histogram phases[kPhases];
+
+        InterfaceStats() : bytes(0), retries(0), connections(0) {}
+    };
+
+    mutable std::mutex mutex;
+    std::ofstream trace;
+    std::map<std::string, InterfaceStats> interfaces;
+    std::map<int64_t, int> failed_ends;
+
+    TransferMetrics(const TransferMetrics&);
+    TransferMetrics& operator=(const TransferMetrics&);
+};
+
+// Serves one text document over plain HTTP on 127.0.0.1:port for
+// Prometheus to scrape; every request gets a fresh render
+class MetricsEndpoint {
+public:
+    typedef std::function<std::string()> Render;
+
+    MetricsEndpoint();
+    ~MetricsEndpoint();
+
+    bool start(int port, Render render, std::string& error);
+    void stop();
+
+private:
+    int fd;
+    std::thread server;
+    std::atomic<bool> running;
+    Render render;
+
+    void serve_loop();
+
+    MetricsEndpoint(const MetricsEndpoint&);
+    MetricsEndpoint& operator=(const MetricsEndpoint&);
+};
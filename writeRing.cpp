@@ -0,0 +1,306 @@
+#include "writeRing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+namespace {
+
+// No liburing: the three system calls are all this needs
+int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                                    nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+// Fewer buffers than this are not worth a ring
+const size_t kMinRingBuffers = 2;
+
+// Kept out of the memlock allowance for the rings' own mappings (older
+// kernels count them too) and whatever else the process locks
+const size_t kMemlockReserve = 256 * 1024;
+
+// Bytes of registered buffers held by the process's live rings
+std::mutex g_pinned_mutex;
+size_t g_pinned = 0;
+
+// How many of the buffers fit into half of the memlock allowance the other
+// rings left; the caller owns their bytes until release_pinned()
+size_t reserve_pinned(size_t buffers, size_t buffer_size) {
+    std::lock_guard<std::mutex> lock(g_pinned_mutex);
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        size_t allowance = static_cast<size_t>(limit.rlim_cur);
+        size_t left = allowance > g_pinned + kMemlockReserve ? allowance - g_pinned - kMemlockReserve : 0;
+        buffers = std::min(buffers, left / 2 / buffer_size);
+    }
+    if (buffers < kMinRingBuffers) return 0;
+    g_pinned += buffers * buffer_size;
+    return buffers;
+}
+
+void release_pinned(size_t bytes) {
+    std::lock_guard<std::mutex> lock(g_pinned_mutex);
+    g_pinned -= bytes;
+}
+
+} // namespace
+
+WriteRing::WriteRing(OutputFile& file, size_t buffers, size_t buffer_size)
+    : file(file),
+      ring_fd(-1),
+      broken(false),
+      buffer_size(buffer_size),
+      memory(nullptr),
+      in_flight(0),
+      to_submit(0),
+      pinned(0),
+      sq_map(MAP_FAILED),
+      sq_map_size(0),
+      cq_map(MAP_FAILED),
+      cq_map_size(0),
+      sqe_map(MAP_FAILED),
+      sqe_map_size(0) {
+    buffers = reserve_pinned(buffers, buffer_size);
+    if (buffers == 0) {
+        reason = "the memlock limit leaves no room for io_uring buffers";
+        return;
+    }
+    pinned = buffers * buffer_size;
+    void* block = nullptr;
+    if (posix_memalign(&block, 4096, buffers * buffer_size) != 0) {
+        reason = "out of memory for io_uring buffers";
+        return;
+    }
+    memory = static_cast<char*>(block);
+
+    if (!setup(buffers)) {
+        if (reason.empty()) reason = std::string("io_uring: ") + strerror(errno);
+        if (ring_fd >= 0) ::close(ring_fd);
+        ring_fd = -1;
+        return;
+    }
+    for (size_t i = 0; i < buffers; i++) {
+        slots.push_back(Slot{nullptr, 0, 0, 0, false});
+        free_slots.push_back(static_cast<int>(buffers - 1 - i));
+    }
+}
+
+WriteRing::~WriteRing() {
+    // The kernel may still be reading the buffers
+    if (available()) drain();
+    if (sqe_map != MAP_FAILED) munmap(sqe_map, sqe_map_size);
+    if (cq_map != MAP_FAILED && cq_map != sq_map) munmap(cq_map, cq_map_size);
+    if (sq_map != MAP_FAILED) munmap(sq_map, sq_map_size);
+    if (ring_fd >= 0) ::close(ring_fd);
+    free(memory);
+    if (pinned > 0) release_pinned(pinned);
+}
+
+bool WriteRing::setup(size_t entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = io_uring_setup(static_cast<unsigned>(entries), &params);
+    if (ring_fd < 0) return false;
+
+    sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+
+    sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) return false;
+    cq_map = single_mmap ? sq_map
+                         : mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_map == MAP_FAILED) return false;
+    sqe_map_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqe_map = mmap(nullptr, sqe_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd, IORING_OFF_SQES);
+    if (sqe_map == MAP_FAILED) return false;
+
+    char* sq = static_cast<char*>(sq_map);
+    char* cq = static_cast<char*>(cq_map);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+    sqes = sqe_map;
+
+    // Registered buffers spare the kernel pinning pages on every write.
+    // Without them (memlock limit) plain pwrite is just as good.
+    std::vector<struct iovec> iov(entries);
+    for (size_t i = 0; i < entries; i++) {
+        iov[i].iov_base = memory + i * buffer_size;
+        iov[i].iov_len = buffer_size;
+    }
+    if (io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, iov.data(),
+                          static_cast<unsigned>(entries)) != 0) {
+        reason = std::string("registering io_uring buffers: ") + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool WriteRing::write(RingStream& stream, const char* data, size_t len, int64_t offset) {
+    if (broken) return false;
+    if (stream.buffer >= 0 && offset != stream.start + static_cast<int64_t>(stream.filled)) {
+        flush(stream);
+    }
+    while (len > 0) {
+        if (stream.buffer < 0) {
+            int slot = take_slot();
+            if (slot < 0) {
+                // Every buffer is staged or in flight: write this directly
+                return !broken && file.write_at(data, len, offset);
+            }
+            slots[slot] = Slot{&stream, offset, 0, 0, true};
+            stream.buffer = slot;
+            stream.start = offset;
+            stream.filled = 0;
+        }
+        size_t n = std::min(len, buffer_size - stream.filled);
+        memcpy(memory + stream.buffer * buffer_size + stream.filled, data, n);
+        stream.filled += n;
+        data += n;
+        len -= n;
+        offset += n;
+        if (stream.filled == buffer_size) flush(stream);
+    }
+    return true;
+}
+
+void WriteRing::flush(RingStream& stream) {
+    if (stream.buffer < 0) return;
+    int slot = stream.buffer;
+    stream.buffer = -1;
+    if (stream.filled == 0) {
+        slots[slot].busy = false;
+        free_slots.push_back(slot);
+        return;
+    }
+    slots[slot].length = stream.filled;
+    stream.start += stream.filled;
+    stream.filled = 0;
+    stream.pending++;
+    queue(slot);
+}
+
+void WriteRing::submit() {
+    if (broken) return;
+    if (to_submit > 0) enter(0);
+    reap();
+}
+
+bool WriteRing::drain() {
+    while (in_flight > 0 && !broken) {
+        if (!enter(1)) break;
+        reap();
+    }
+    return !broken;
+}
+
+// Never waits: the network thread must not stall on the disk
+int WriteRing::take_slot() {
+    if (free_slots.empty() && in_flight > 0 && !broken) submit();
+    if (free_slots.empty()) return -1;
+    int slot = free_slots.back();
+    free_slots.pop_back();
+    return slot;
+}
+
+void WriteRing::queue(int slot) {
+    const Slot& s = slots[slot];
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = file.descriptor();
+    sqe->addr = reinterpret_cast<uint64_t>(memory + slot * buffer_size + s.written);
+    sqe->len = static_cast<uint32_t>(s.length - s.written);
+    sqe->off = static_cast<uint64_t>(s.offset + s.written);
+    sqe->buf_index = static_cast<uint16_t>(slot);
+    sqe->user_data = static_cast<uint64_t>(slot);
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    to_submit++;
+    in_flight++;
+}
+
+// Submits what is queued and, with wait_for > 0, blocks for that many
+// completions. A ring that stops accepting work fails every write in it.
+bool WriteRing::enter(unsigned wait_for) {
+    while (true) {
+        int n = io_uring_enter(ring_fd, to_submit, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (n >= 0) {
+            to_submit -= std::min(to_submit, static_cast<unsigned>(n));
+            return true;
+        }
+        if (errno == EINTR) continue;
+        break;
+    }
+    broken = true;
+    for (auto& s : slots) {
+        if (s.busy && s.stream && !s.stream->failed) {
+            s.stream->failed = true;
+            s.stream->failed_at = s.offset + s.written;
+        }
+    }
+    return false;
+}
+
+void WriteRing::reap() {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const struct io_uring_cqe* cqe = static_cast<const struct io_uring_cqe*>(cqes) + (head & *cq_mask);
+        int slot = static_cast<int>(cqe->user_data);
+        int res = cqe->res;
+        head++;
+        in_flight--;
+
+        Slot& s = slots[slot];
+        if (res == -EINTR || res == -EAGAIN) {
+            queue(slot);
+            continue;
+        }
+        if (res > 0) {
+            s.written += res;
+            // Short write: the rest goes out as a new request
+            if (s.written < s.length) {
+                queue(slot);
+                continue;
+            }
+        } else {
+            int64_t lost = s.offset + s.written;
+            if (!s.stream->failed || lost < s.stream->failed_at) s.stream->failed_at = lost;
+            s.stream->failed = true;
+        }
+        s.stream->pending--;
+        s.busy = false;
+        s.stream = nullptr;
+        free_slots.push_back(slot);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
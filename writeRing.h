@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "outputFile.h"
+
+// Staging state of one sequential writer (a range transfer). Its bytes are
+// gathered into a ring buffer and written out a buffer at a time.
+struct RingStream {
+    int buffer;         // staging buffer, -1 when none
+    size_t filled;
+    int64_t start;      // file offset of the staged bytes
+    unsigned pending;   // buffers queued whose writes have not completed
+    bool failed;        // a write of this stream failed ...
+    int64_t failed_at;  // ... at this offset; bytes from here on are lost
+
+    RingStream() : buffer(-1), filled(0), start(0), pending(0), failed(false), failed_at(0) {}
+};
+
+// Asynchronous, batched writes into an OutputFile through io_uring, for use
+// by a single thread. Arriving bytes are copied into registered buffers and
+// written at their offsets by the kernel while the thread goes back to the
+// network; every write queued during a poll round goes out with one
+// io_uring_enter. Where the kernel has no io_uring (or a seccomp policy
+// forbids it) available() is false and callers write with
+// OutputFile::write_at instead. The registered buffers count against
+// RLIMIT_MEMLOCK, which all rings of the process share: a ring takes at
+// most half of what the others left, with fewer buffers than asked if need
+// be.
+class WriteRing {
+public:
+    WriteRing(OutputFile& file, size_t buffers, size_t buffer_size);
+    ~WriteRing();
+
+    bool available() const { return ring_fd >= 0; }
+
+    // Why the ring is not available
+    const std::string& failure() const { return reason; }
+
+    // Becomes readable when writes complete, for the caller's poll
+    int descriptor() const { return ring_fd; }
+
+    // Stages len bytes for offset. Bytes that do not continue the stream's
+    // staged run start a new one. When every buffer is busy the bytes are
+    // written directly rather than waiting for one. False once the ring
+    // itself has failed.
+    bool write(RingStream& stream, const char* data, size_t len, int64_t offset);
+
+    // Queues whatever the stream has staged
+    void flush(RingStream& stream);
+
+    // Hands queued writes to the kernel and collects finished ones without
+    // waiting; called once per poll round
+    void submit();
+
+    // True once every write the stream queued has completed, successfully
+    // or not (failed writes mark it); does not wait
+    bool settled(const RingStream& stream) const { return stream.pending == 0 || broken; }
+
+    // Waits until every queued write has finished. Streams whose writes
+    // failed are marked; false if the ring itself stopped working.
+    bool drain();
+
+private:
+    // One staging buffer and the write it is part of
+    struct Slot {
+        RingStream* stream;
+        int64_t offset;
+        size_t length;
+        size_t written;
+        bool busy;
+    };
+
+    OutputFile& file;
+    int ring_fd;
+    bool broken;
+    size_t buffer_size;
+    char* memory;
+    std::vector<Slot> slots;
+    std::vector<int> free_slots;
+    unsigned in_flight;     // writes the kernel has not completed
+    unsigned to_submit;     // SQEs filled in since the last enter
+    size_t pinned;          // bytes taken from the memlock allowance
+    std::string reason;
+
+    // Mapped ring state
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    void* sqe_map;
+    size_t sqe_map_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    void* cqes;
+    void* sqes;
+
+    WriteRing(const WriteRing&);
+    WriteRing& operator=(const WriteRing&);
+
+    bool setup(size_t entries);
+    int take_slot();
+    void queue(int slot);
+    bool enter(unsigned wait_for);
+    void reap();
+};